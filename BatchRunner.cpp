@@ -0,0 +1,265 @@
+#include "BatchRunner.hpp"
+#include "DirectoryWatcher.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Set by SIGINT and SIGTERM to stop watching.
+volatile std::sig_atomic_t stopWatching = 0;
+
+void requestStopWatching(int) { stopWatching = 1; }
+
+std::string trim(const std::string &text) {
+  auto first = text.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+    return "";
+  }
+  auto last = text.find_last_not_of(" \t\r");
+  return text.substr(first, last - first + 1);
+}
+
+// Reads a file holding one job per line, skipping empty lines and lines
+// starting with '#'.
+template <typename Job>
+std::vector<Job> loadJobs(const boost::filesystem::path &jobFile,
+                          Job (*parseJob)(const std::string &)) {
+  std::ifstream inputFile(jobFile.string());
+  if (!inputFile.is_open()) {
+    throw std::runtime_error("BAD INPUT FILE: " + jobFile.string());
+  }
+
+  std::vector<Job> jobs;
+  int lineNumber = 0;
+  for (std::string line; std::getline(inputFile, line);) {
+    ++lineNumber;
+    line = trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    try {
+      jobs.push_back(parseJob(line));
+    } catch (const std::exception &error) {
+      throw std::runtime_error(jobFile.string() + ":" +
+                               std::to_string(lineNumber) + ": " +
+                               error.what());
+    }
+  }
+  return jobs;
+}
+
+} // namespace
+
+ConductanceJob parseConductanceJob(const std::string &line) {
+  std::vector<std::string> fields;
+  std::istringstream rowToParse(line);
+  for (std::string field; std::getline(rowToParse, field, ',');) {
+    fields.push_back(trim(field));
+  }
+  if (fields.size() != 2 && fields.size() != 4 && fields.size() != 5) {
+    throw std::runtime_error("Expected date,R value[,top left,bottom "
+                             "right[,pixel coordinates]] but got: " +
+                             line);
+  }
+
+  ConductanceJob job;
+  job.date = fields[0];
+  job.rValue = std::stoi(fields[1]);
+  std::string topLeftCoordinate = "EX72";
+  std::string bottomRightCoordinate = "VN434";
+  if (fields.size() >= 4) {
+    topLeftCoordinate = fields[2];
+    bottomRightCoordinate = fields[3];
+  }
+  job.cropWindow.topLeft =
+      ImageConverter::convertExcelNumberToStandard(topLeftCoordinate);
+  job.cropWindow.bottomRight =
+      ImageConverter::convertExcelNumberToStandard(bottomRightCoordinate);
+
+  if (fields.size() == 5) {
+    std::istringstream coordinates(fields[4]);
+    for (std::string coordinate; coordinates >> coordinate;) {
+      job.pixelCoordinates.push_back(coordinate);
+    }
+  }
+  return job;
+}
+
+std::vector<ConductanceJob>
+loadConductanceJobs(const boost::filesystem::path &jobFile) {
+  return loadJobs(jobFile, parseConductanceJob);
+}
+
+KMatrixJob parseKMatrixJob(const std::string &line) {
+  std::vector<std::string> fields;
+  std::istringstream rowToParse(line);
+  for (std::string field; std::getline(rowToParse, field, ',');) {
+    fields.push_back(trim(field));
+  }
+  if (fields.size() != 6 && fields.size() != 8) {
+    throw std::runtime_error(
+        "Expected directory,R value,upper before,upper after,lower "
+        "before,lower after[,top left,bottom right] but got: " +
+        line);
+  }
+
+  KMatrixJob job;
+  job.directory = fields[0];
+  job.rValue = std::stoi(fields[1]);
+  job.upperBeforeThermocouple = std::stod(fields[2]);
+  job.upperAfterThermocouple = std::stod(fields[3]);
+  job.lowerBeforeThermocouple = std::stod(fields[4]);
+  job.lowerAfterThermocouple = std::stod(fields[5]);
+  std::string topLeftCoordinate = "EX72";
+  std::string bottomRightCoordinate = "VN434";
+  if (fields.size() == 8) {
+    topLeftCoordinate = fields[6];
+    bottomRightCoordinate = fields[7];
+  }
+  job.cropWindow.topLeft =
+      ImageConverter::convertExcelNumberToStandard(topLeftCoordinate);
+  job.cropWindow.bottomRight =
+      ImageConverter::convertExcelNumberToStandard(bottomRightCoordinate);
+  return job;
+}
+
+std::vector<KMatrixJob>
+loadKMatrixJobs(const boost::filesystem::path &manifest) {
+  return loadJobs(manifest, parseKMatrixJob);
+}
+
+BatchRunner::BatchRunner(const boost::filesystem::path &baseDirectory,
+                         const ConverterOptions &options)
+    : baseDirectory(baseDirectory), options(options),
+      threadPool(std::make_shared<ThreadPool>(options.workerCount)) {}
+
+int BatchRunner::run(const std::vector<ConductanceJob> &jobs) {
+  int failedJobs = 0;
+  for (auto &&job : jobs) {
+    try {
+      ImageConverter converter(baseDirectory, job, options, threadPool,
+                               kMatrixStoreFor(job.cropWindow));
+    } catch (const std::exception &error) {
+      std::cout << "ERROR: the job for " << job.date
+                << " failed: " << error.what() << std::endl;
+      ++failedJobs;
+    }
+  }
+  std::cout << "Finished " << jobs.size() - failedJobs << " of "
+            << jobs.size() << " jobs." << std::endl;
+  return failedJobs;
+}
+
+int BatchRunner::runKMatrixJobs(const std::vector<KMatrixJob> &jobs) {
+  try {
+    ImageConverter converter(baseDirectory, jobs, options, threadPool);
+  } catch (const std::exception &error) {
+    std::cout << "ERROR: the K matrices could not be created: "
+              << error.what() << std::endl;
+    return 1;
+  }
+  std::cout << "Created " << jobs.size() << " K matrices." << std::endl;
+  return 0;
+}
+
+int BatchRunner::watch(const ConductanceJob &job, double settleSeconds) {
+  using Clock = std::chrono::steady_clock;
+  boost::filesystem::path dateDirectory(baseDirectory.generic_string() +
+                                        "Data/" + job.date + "/");
+  boost::filesystem::path temperatureImagesDirectory =
+      dateDirectory / "TempImages";
+  boost::filesystem::path kMatrixDirectory(baseDirectory.generic_string() +
+                                           "KMatrix/");
+
+  ConverterOptions watchOptions = options;
+  watchOptions.recomputeChangedOnly = true;
+  watchOptions.skipImagesWithoutFrames = true;
+
+  DirectoryWatcher watcher;
+  int temperatureImages, date, kMatrices;
+  try {
+    // The camera may not have written anything yet.
+    boost::filesystem::create_directories(temperatureImagesDirectory);
+    temperatureImages = watcher.watch(temperatureImagesDirectory);
+    date = watcher.watch(dateDirectory);
+    kMatrices = watcher.watch(kMatrixDirectory);
+  } catch (const std::exception &error) {
+    std::cout << "ERROR: " << error.what() << std::endl;
+    return 1;
+  }
+
+  stopWatching = 0;
+  auto previousInterruptHandler = std::signal(SIGINT, requestStopWatching);
+  auto previousTerminateHandler = std::signal(SIGTERM, requestStopWatching);
+  std::cout << "Watching " << temperatureImagesDirectory.string()
+            << " for frames. Press Ctrl-C to stop." << std::endl;
+
+  // Whatever is there already is processed straight away.
+  const Clock::duration settleTime =
+      std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(settleSeconds));
+  bool pending = true;
+  Clock::time_point lastChange = Clock::now() - settleTime;
+  while (!stopWatching) {
+    int timeout = -1;
+    if (pending) {
+      auto remaining = lastChange + settleTime - Clock::now();
+      timeout = std::max<int>(
+          0, std::chrono::duration_cast<std::chrono::milliseconds>(remaining)
+                 .count());
+    }
+    for (auto &&change : watcher.wait(timeout)) {
+      // The converter's own outputs, the frame cache and editor files are
+      // not inputs.
+      bool hidden = !change.fileName.empty() && change.fileName[0] == '.';
+      if (hidden || (change.directory == date &&
+                     change.fileName != "DataExtraction.csv")) {
+        continue;
+      }
+      // Resident K matrices are reloaded when their files change.
+      if (change.directory == kMatrices || change.directory == -1) {
+        kMatrixStores.clear();
+      }
+      if (change.directory == kMatrices || change.directory == -1 ||
+          change.directory == temperatureImages || change.directory == date) {
+        pending = true;
+        lastChange = Clock::now();
+      }
+    }
+    if (stopWatching || !pending || Clock::now() - lastChange < settleTime) {
+      continue;
+    }
+
+    pending = false;
+    try {
+      ImageConverter converter(baseDirectory, job, watchOptions, threadPool,
+                               kMatrixStoreFor(job.cropWindow));
+    } catch (const std::exception &error) {
+      // Usually a file caught half written; it is retried once it changes.
+      std::cout << "ERROR: the maps of " << job.date
+                << " could not be updated: " << error.what() << std::endl;
+    }
+    std::cout << "Waiting for changes." << std::endl;
+  }
+
+  std::signal(SIGINT, previousInterruptHandler);
+  std::signal(SIGTERM, previousTerminateHandler);
+  std::cout << "Stopped watching " << job.date << "." << std::endl;
+  return 0;
+}
+
+std::shared_ptr<KMatrixStore>
+BatchRunner::kMatrixStoreFor(const CropWindow &cropWindow) {
+  CropKey key(cropWindow.topLeft.first, cropWindow.topLeft.second,
+              cropWindow.bottomRight.first, cropWindow.bottomRight.second);
+  auto &store = kMatrixStores[key];
+  if (!store) {
+    store = std::make_shared<KMatrixStore>();
+  }
+  return store;
+}
@@ -0,0 +1,80 @@
+#ifndef BATCH_RUNNER
+#define BATCH_RUNNER
+
+#include "ImageConverter.hpp"
+#include <boost/filesystem.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Parses a job written as
+//
+//   date,R value[,top left,bottom right[,pixel coordinates]]
+//
+// where the crop window corners are Excel coordinates (EX72 and VN434 when
+// left out) and the pixel coordinates are Excel coordinates separated by
+// spaces.
+ConductanceJob parseConductanceJob(const std::string &);
+
+// Reads a job file holding one job per line. Empty lines and lines starting
+// with '#' are skipped.
+std::vector<ConductanceJob>
+loadConductanceJobs(const boost::filesystem::path &);
+
+// Parses a K matrix job written as
+//
+//   directory,R value,upper before,upper after,lower before,lower after
+//   [,top left,bottom right]
+//
+// where the four thermocouple temperatures are those asked for by the
+// interactive K matrix program, and a relative directory is inside the
+// KMatrix directory.
+KMatrixJob parseKMatrixJob(const std::string &);
+
+// Reads a K matrix manifest holding one K matrix job per line. Empty lines
+// and lines starting with '#' are skipped.
+std::vector<KMatrixJob> loadKMatrixJobs(const boost::filesystem::path &);
+
+// Runs conductance map jobs one after another in a single process. The worker
+// threads are started once, and every K matrix is loaded once per crop window
+// for the whole batch rather than once per date.
+class BatchRunner {
+public:
+  BatchRunner(const boost::filesystem::path &baseDirectory,
+              const ConverterOptions &);
+
+  // Runs every job, even after one fails, and returns the number of jobs
+  // that failed.
+  int run(const std::vector<ConductanceJob> &);
+
+  // Creates the K matrices of every job at once, and returns 1 if they could
+  // not all be created.
+  int runKMatrixJobs(const std::vector<KMatrixJob> &);
+
+  // Keeps the conductance maps of the job's date up to date while its
+  // experiment runs, until interrupted. Whenever frames arrive in the
+  // temperature images directory or the program data file is saved, and
+  // nothing more has changed for settleSeconds, the images whose inputs
+  // changed are recomputed, as --incremental does. Rows whose frames have
+  // not arrived yet wait for them. The K matrices stay loaded between runs
+  // until a file of the K matrix directory changes. Returns 1 if the
+  // directories could not be watched.
+  int watch(const ConductanceJob &, double settleSeconds);
+
+private:
+  using CropKey = std::tuple<int, int, int, int>;
+
+  boost::filesystem::path baseDirectory;
+  ConverterOptions options;
+  std::shared_ptr<ThreadPool> threadPool;
+
+  // K matrices are loaded through the crop window, so each window has its own
+  // store. Every job reads them from the same K matrix directory.
+  std::map<CropKey, std::shared_ptr<KMatrixStore>> kMatrixStores;
+
+  std::shared_ptr<KMatrixStore> kMatrixStoreFor(const CropWindow &);
+};
+
+#endif
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.hpp"
+#include "BoxFilter.hpp"
+#include "ConductanceKernel.hpp"
+#include "FrameAccumulator.hpp"
+#include "FrameCache.hpp"
+#include "FrameReader.hpp"
+#include "ImageWriter.hpp"
+#include "IntegralImage.hpp"
+#include "SyntheticData.hpp"
+
+// Times each stage of the conductance pipeline on synthetic data, so that
+// changes can be measured on any machine without the lab data.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Stage {
+  std::string name;
+  double seconds;
+  uintmax_t bytes;
+  uint64_t items;
+  std::string itemName;
+};
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void printUsage() {
+  std::cout << "Usage: TemperatureToConductanceBenchmark [options]"
+            << std::endl;
+  std::cout << "\t--dir DIR\tWrite the synthetic data to DIR (default: a new "
+               "temporary directory, removed afterwards)."
+            << std::endl;
+  std::cout << "\t--width N, --height N\tFrame size (default: 640x480)."
+            << std::endl;
+  std::cout << "\t--images N\tNumber of average images (default: 4)."
+            << std::endl;
+  std::cout << "\t--frames N\tFrames per image (default: 10)." << std::endl;
+  std::cout << "\t--kmatrices N\tNumber of K matrices (default: 2)."
+            << std::endl;
+  std::cout << "\t--queries N\tLeaflet queries per image (default: 100000)."
+            << std::endl;
+  std::cout << "\t--kernel NAME\tConductance kernel: auto, scalar, avx2 or "
+               "avx512 (default: auto)."
+            << std::endl;
+  std::cout << "\t--workers N\tThreads of the pipeline stage (default: one "
+               "per hardware thread)."
+            << std::endl;
+  std::cout << "\t--keep\tKeep the synthetic data and outputs." << std::endl;
+  std::cout << "\t--check-kernels\tOnly compare the vector kernels with the "
+               "scalar kernel, which every benchmark does first."
+            << std::endl;
+}
+
+void printStages(const std::vector<Stage> &stages) {
+  std::printf("%-22s %10s %10s %16s\n", "Stage", "Seconds", "MB/s",
+              "Throughput");
+  for (auto &&stage : stages) {
+    double megabytesPerSecond = stage.bytes / 1e6 / stage.seconds;
+    double itemsPerSecond = stage.items / stage.seconds;
+    char bytesText[32] = "-";
+    if (stage.bytes > 0) {
+      std::snprintf(bytesText, sizeof(bytesText), "%.1f", megabytesPerSecond);
+    }
+    std::printf("%-22s %10.4f %10s %10.3g %s/s\n", stage.name.c_str(),
+                stage.seconds, bytesText, itemsPerSecond,
+                stage.itemName.c_str());
+  }
+}
+
+// Compares every vector kernel the processor supports with the scalar kernel,
+// for both ways of evaluating wp, over temperatures that include both ends of
+// the wp table and some far enough from anything physical that exp(-Tw / T)
+// overflows, goes subnormal or underflows. Returns false if any pixel of a
+// kernel is further from the scalar kernel than kernelRelativeErrorBound
+// allows, or is not finite where the scalar kernel's is.
+bool checkKernels() {
+  const double temperatures[] = {
+      -60.0,    -50.0,   -49.9999, -49.996, -49.995, -49.994,  -49.99,
+      -49.5,    -20.0,   0.0,      21.37,   25.004,  99.99,    149.98,
+      149.99,   149.995, 149.9999, 150.0,   150.01,  160.0,    -300.0,
+      -280.0,   -273.15, -272.0,   -266.0,  -260.0,  -220.7,   -200.0,
+      std::nan("")};
+  const int count = sizeof(temperatures) / sizeof(temperatures[0]);
+  // Each temperature fills a whole vector of the widest kernel, since a
+  // vector with a lane outside the table is looked up a lane at a time. The
+  // extra columns also run the scalar tail of the vector kernels.
+  const int lanes = 16;
+  const int width = lanes * count + 3;
+  Image temperatureRow(width, 1);
+  Image kRow(width, 1);
+  for (int column = 0; column < width; ++column) {
+    temperatureRow(0, column) = temperatures[column / lanes % count];
+    kRow(0, column) = 5.0 + 0.01 * column;
+  }
+
+  std::vector<KernelInstructionSet> kernels = {KernelInstructionSet::Avx2,
+                                               KernelInstructionSet::Avx512};
+  bool passed = true;
+  for (auto &&kernel : kernels) {
+    if (int(kernel) > int(bestKernelInstructionSet())) {
+      continue;
+    }
+    for (auto &&evaluation :
+         {SaturationEvaluation::Exact, SaturationEvaluation::Table}) {
+      ConductanceParameters parameters;
+      parameters.rValue = 300;
+      parameters.wa = 0.012;
+      parameters.airTemps = std::make_pair(22.0, 1.0);
+      parameters.numberColumns = width;
+      parameters.saturationEvaluation = evaluation;
+      std::vector<Scalar> scalar(width);
+      std::vector<Scalar> vector(width);
+      calculateConductanceRow(parameters, temperatureRow.rowData(0),
+                              kRow.rowData(0), scalar.data(), width,
+                              KernelInstructionSet::Scalar);
+      calculateConductanceRow(parameters, temperatureRow.rowData(0),
+                              kRow.rowData(0), vector.data(), width, kernel);
+      double worst = 0.0;
+      bool close = true;
+      for (int column = 0; column < width; ++column) {
+        if (vector[column] == scalar[column] ||
+            (std::isnan(vector[column]) && std::isnan(scalar[column]))) {
+          continue;
+        }
+        double difference = std::abs(double(vector[column]) - scalar[column]);
+        double relativeDifference =
+            difference / std::abs(double(scalar[column]));
+        worst = std::max(worst, relativeDifference);
+        close = close && relativeDifference <=
+                             kernelRelativeErrorBound<Scalar>(
+                                 parameters, kRow(0, column), column,
+                                 temperatureRow(0, column));
+      }
+      passed = passed && close;
+      std::cout << "Kernel check: " << kernelInstructionSetName(kernel) << " "
+                << (evaluation == SaturationEvaluation::Table ? "table"
+                                                              : "exact")
+                << " wp, largest relative difference " << worst
+                << (close ? "" : " FAILED") << std::endl;
+    }
+  }
+  return passed;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  SyntheticDataOptions dataOptions;
+  boost::filesystem::path directory;
+  int queriesPerImage = 100000;
+  bool keep = false;
+  bool onlyCheckKernels = false;
+  ConverterOptions options;
+  options.useFrameCache = false;
+
+  std::vector<std::string> arguments(argv + 1, argv + argc);
+  try {
+    for (size_t i = 0; i < arguments.size(); ++i) {
+      bool hasValue = i + 1 < arguments.size();
+      if (arguments[i] == "--dir" && hasValue) {
+        directory = arguments[++i];
+      } else if (arguments[i] == "--width" && hasValue) {
+        dataOptions.width = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--height" && hasValue) {
+        dataOptions.height = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--images" && hasValue) {
+        dataOptions.imageCount = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--frames" && hasValue) {
+        dataOptions.framesPerImage = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--kmatrices" && hasValue) {
+        dataOptions.kMatrixCount = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--queries" && hasValue) {
+        queriesPerImage = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--kernel" && hasValue) {
+        options.kernelInstructionSet =
+            parseKernelInstructionSet(arguments[++i]);
+      } else if (arguments[i] == "--workers" && hasValue) {
+        options.workerCount = std::stoi(arguments[++i]);
+      } else if (arguments[i] == "--keep") {
+        keep = true;
+      } else if (arguments[i] == "--check-kernels") {
+        onlyCheckKernels = true;
+      } else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (const std::exception &error) {
+    std::cout << "ERROR: " << error.what() << std::endl;
+    return 1;
+  }
+
+  // Timings of a kernel that gives wrong answers are meaningless.
+  if (!checkKernels()) {
+    return 1;
+  }
+  if (onlyCheckKernels) {
+    return 0;
+  }
+
+  bool temporaryDirectory = directory.empty();
+  if (temporaryDirectory) {
+    directory = boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("t2c-benchmark-%%%%%%");
+  }
+
+  std::vector<Stage> stages;
+  try {
+    const uint64_t framePixels =
+        uint64_t(dataOptions.width) * dataOptions.height;
+    const uint64_t allFramePixels =
+        framePixels * dataOptions.imageCount * dataOptions.framesPerImage;
+    std::cout << "Writing " << dataOptions.imageCount << " images of "
+              << dataOptions.framesPerImage << " " << dataOptions.width << "x"
+              << dataOptions.height << " frames to " << directory.string()
+              << std::endl;
+    auto start = Clock::now();
+    SyntheticData data = writeSyntheticData(directory, dataOptions);
+    stages.push_back({"generate data", secondsSince(start), data.frameBytes,
+                      allFramePixels, "pixels"});
+
+    const CropWindow window = {Coordinate(1, 1),
+                               Coordinate(dataOptions.width,
+                                          dataOptions.height)};
+    FrameReader reader(window);
+    std::vector<Image> kMatrices;
+    for (auto &&kMatrixFile : data.kMatrixFiles) {
+      kMatrices.push_back(reader.read(kMatrixFile));
+    }
+
+    // Frames are parsed and averaged an image at a time.
+    double parseSeconds = 0.0;
+    double averageSeconds = 0.0;
+    std::vector<Image> averages;
+    for (auto &&frames : data.frames) {
+      std::vector<Image> parsedFrames;
+      start = Clock::now();
+      for (auto &&frame : frames) {
+        parsedFrames.push_back(reader.read(frame));
+      }
+      parseSeconds += secondsSince(start);
+
+      start = Clock::now();
+      FrameAccumulator accumulator;
+      for (auto &&frame : parsedFrames) {
+        accumulator.add(frame);
+      }
+      averages.push_back(accumulator.mean());
+      averageSeconds += secondsSince(start);
+    }
+    stages.push_back({"parse frames", parseSeconds, data.frameBytes,
+                      allFramePixels, "pixels"});
+    stages.push_back({"average frames", averageSeconds, 0, allFramePixels,
+                      "pixels"});
+
+    // The first pass writes the frame cache, the second reads it.
+    FrameCache cache(window);
+    for (auto &&frames : data.frames) {
+      for (auto &&frame : frames) {
+        cache.load(frame);
+      }
+    }
+    start = Clock::now();
+    for (auto &&frames : data.frames) {
+      for (auto &&frame : frames) {
+        cache.load(frame);
+      }
+    }
+    stages.push_back({"load cached frames", secondsSince(start),
+                      allFramePixels * sizeof(Scalar), allFramePixels,
+                      "pixels"});
+
+    std::vector<ConductanceParameters> parameters;
+    for (size_t image = 0; image < averages.size(); ++image) {
+      ConductanceParameters imageParameters;
+      imageParameters.rValue = 300;
+      imageParameters.wa = 0.010 + 0.001 * (image + 1);
+      imageParameters.airTemps = std::make_pair(22.5 + 0.5 * image, 0.0);
+      imageParameters.numberColumns = dataOptions.width;
+      imageParameters.saturationEvaluation = options.saturationEvaluation;
+      parameters.push_back(imageParameters);
+    }
+    const uint64_t allImagePixels = framePixels * averages.size();
+
+    std::vector<Image> conductanceMaps;
+    start = Clock::now();
+    for (size_t image = 0; image < averages.size(); ++image) {
+      conductanceMaps.push_back(calculateConductanceImage(
+          parameters[image], averages[image],
+          kMatrices[image % kMatrices.size()], options.kernelInstructionSet));
+    }
+    stages.push_back({"conductance maps", secondsSince(start),
+                      allImagePixels * 3 * sizeof(Scalar), allImagePixels,
+                      "pixels"});
+
+    const LeafletWindow leafletWindow;
+    start = Clock::now();
+    for (size_t image = 0; image < averages.size(); ++image) {
+      calculateConductanceImage(
+          parameters[image],
+          boxFilter(averages[image], leafletWindow,
+                    options.kernelInstructionSet),
+          boxFilter(kMatrices[image % kMatrices.size()], leafletWindow,
+                    options.kernelInstructionSet),
+          options.kernelInstructionSet);
+    }
+    stages.push_back({"leaflet maps", secondsSince(start), 0, allImagePixels,
+                      "pixels"});
+
+    std::mt19937 generator(dataOptions.seed);
+    std::uniform_int_distribution<int> row(0, dataOptions.height - 1);
+    std::uniform_int_distribution<int> column(0, dataOptions.width - 1);
+    double leafletSum = 0.0;
+    start = Clock::now();
+    for (auto &&average : averages) {
+      IntegralImage sums(average);
+      for (int query = 0; query < queriesPerImage; ++query) {
+        leafletSum +=
+            sums.mean(Coordinate(column(generator), row(generator)),
+                      leafletWindow);
+      }
+    }
+    stages.push_back({"leaflet queries", secondsSince(start), 0,
+                      uint64_t(queriesPerImage) * averages.size(),
+                      "queries"});
+
+    boost::filesystem::path outputDirectory = directory / "Output";
+    boost::filesystem::create_directories(outputDirectory);
+    const std::pair<ImageFormat, std::string> formats[] = {
+        {ImageFormat::Csv, "csv"}, {ImageFormat::Npy, "npy"}};
+    for (auto &&format : formats) {
+      ImageWriter writer(0, format.first);
+      uintmax_t bytes = 0;
+      start = Clock::now();
+      for (size_t image = 0; image < conductanceMaps.size(); ++image) {
+        boost::filesystem::path fileName =
+            outputDirectory /
+            ("Conductance_" + std::to_string(image) + writer.extension());
+        writer.save(fileName, conductanceMaps[image]);
+        bytes += boost::filesystem::file_size(fileName);
+      }
+      stages.push_back({"save maps (" + format.second + ")",
+                        secondsSince(start), bytes, allImagePixels,
+                        "pixels"});
+    }
+
+    // The whole pipeline, as the batch mode runs it, with its progress
+    // messages silenced.
+    ConductanceJob job;
+    job.date = dataOptions.date;
+    job.rValue = 300;
+    job.cropWindow = window;
+    std::ostringstream progress;
+    std::streambuf *console = std::cout.rdbuf(progress.rdbuf());
+    start = Clock::now();
+    // The pipeline expects the base directory to end in a separator.
+    int failedJobs =
+        BatchRunner(directory.string() + "/", options).run({job});
+    double pipelineSeconds = secondsSince(start);
+    std::cout.rdbuf(console);
+    if (failedJobs > 0) {
+      std::cout << progress.str();
+      throw std::runtime_error("The pipeline failed.");
+    }
+    stages.push_back({"whole pipeline", pipelineSeconds, data.frameBytes,
+                      allFramePixels, "pixels"});
+
+    std::cout << "Kernel: "
+              << kernelInstructionSetName(options.kernelInstructionSet)
+              << ", pixel type: " << (sizeof(Scalar) == 4 ? "float" : "double")
+              << ", leaflet checksum: " << leafletSum << std::endl;
+    printStages(stages);
+  } catch (const std::exception &error) {
+    std::cout << "ERROR: " << error.what() << std::endl;
+    if (temporaryDirectory && !keep) {
+      boost::filesystem::remove_all(directory);
+    }
+    return 1;
+  }
+
+  if (temporaryDirectory && !keep) {
+    boost::filesystem::remove_all(directory);
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef BOUNDED_QUEUE
+#define BOUNDED_QUEUE
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// A first in, first out queue between two threads that holds at most
+// capacity items, so a fast producer waits for a slow consumer instead of
+// piling up work in memory.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // Waits while the queue is full. Returns false, dropping the item, if the
+  // queue has been closed.
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // Waits for an item. Returns false once the queue is closed and empty.
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  // Stops the queue accepting items. Items already queued can still be
+  // popped.
+  void close() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+private:
+  const size_t capacity;
+  bool closed;
+  std::deque<T> items;
+  std::mutex queueMutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+};
+
+#endif
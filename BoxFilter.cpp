@@ -0,0 +1,310 @@
+#include "BoxFilter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BOX_FILTER_X86
+#endif
+
+namespace {
+
+const double notANumber = std::numeric_limits<double>::quiet_NaN();
+
+// Adds the entering row to the running column sums and subtracts the leaving
+// row, either of which may be null, then stores the sums times scale.
+// Non-finite values are counted in nonFiniteCounts instead of being summed,
+// and the mean of a column that holds one is NaN; summing them would leave
+// inf - inf = NaN in the sum once they left the window. nonFiniteCounts is
+// null to sum every value; see boxFilterVertical.
+template <bool CountNonFinite>
+void slideColumnSumsScalar(double *columnSums, double *nonFiniteCounts,
+                           const double *entering, const double *leaving,
+                           double scale, double *means, int firstColumn,
+                           int width) {
+  for (int column = firstColumn; column < width; ++column) {
+    if (!CountNonFinite) {
+      if (entering != nullptr) {
+        columnSums[column] += entering[column];
+      }
+      if (leaving != nullptr) {
+        columnSums[column] -= leaving[column];
+      }
+      means[column] = columnSums[column] * scale;
+      continue;
+    }
+    if (entering != nullptr) {
+      if (std::isfinite(entering[column])) {
+        columnSums[column] += entering[column];
+      } else {
+        nonFiniteCounts[column] += 1.0;
+      }
+    }
+    if (leaving != nullptr) {
+      if (std::isfinite(leaving[column])) {
+        columnSums[column] -= leaving[column];
+      } else {
+        nonFiniteCounts[column] -= 1.0;
+      }
+    }
+    means[column] =
+        nonFiniteCounts[column] > 0.0 ? notANumber : columnSums[column] * scale;
+  }
+}
+
+#ifdef BOX_FILTER_X86
+
+typedef double Double4 __attribute__((vector_size(32)));
+typedef double Double8 __attribute__((vector_size(64)));
+
+template <typename Vector, bool CountNonFinite>
+inline __attribute__((always_inline)) void
+slideColumnSumsVector(double *columnSums, double *nonFiniteCounts,
+                      const double *entering, const double *leaving,
+                      double scale, double *means, int width) {
+  const int lanes = sizeof(Vector) / sizeof(double);
+  const Vector zero = {};
+  const Vector one = zero + 1.0;
+  const Vector nan = zero + notANumber;
+  int column = 0;
+  for (; column + lanes <= width; column += lanes) {
+    Vector sums;
+    Vector counts = zero;
+    Vector values;
+    std::memcpy(&sums, columnSums + column, sizeof(Vector));
+    if (CountNonFinite) {
+      std::memcpy(&counts, nonFiniteCounts + column, sizeof(Vector));
+    }
+    // x - x is 0 for finite x and NaN otherwise.
+    if (entering != nullptr) {
+      std::memcpy(&values, entering + column, sizeof(Vector));
+      if (CountNonFinite) {
+        auto finite = values - values == zero;
+        sums += finite ? values : zero;
+        counts += finite ? zero : one;
+      } else {
+        sums += values;
+      }
+    }
+    if (leaving != nullptr) {
+      std::memcpy(&values, leaving + column, sizeof(Vector));
+      if (CountNonFinite) {
+        auto finite = values - values == zero;
+        sums -= finite ? values : zero;
+        counts -= finite ? zero : one;
+      } else {
+        sums -= values;
+      }
+    }
+    std::memcpy(columnSums + column, &sums, sizeof(Vector));
+    Vector mean = sums * scale;
+    if (CountNonFinite) {
+      std::memcpy(nonFiniteCounts + column, &counts, sizeof(Vector));
+      mean = counts > zero ? nan : mean;
+    }
+    std::memcpy(means + column, &mean, sizeof(Vector));
+  }
+  slideColumnSumsScalar<CountNonFinite>(columnSums, nonFiniteCounts, entering,
+                                        leaving, scale, means, column, width);
+}
+
+__attribute__((target("avx2"))) void
+slideColumnSumsAvx2(double *columnSums, double *nonFiniteCounts,
+                    const double *entering, const double *leaving,
+                    double scale, double *means, int width) {
+  if (nonFiniteCounts != nullptr) {
+    slideColumnSumsVector<Double4, true>(columnSums, nonFiniteCounts, entering,
+                                         leaving, scale, means, width);
+  } else {
+    slideColumnSumsVector<Double4, false>(columnSums, nullptr, entering,
+                                          leaving, scale, means, width);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+slideColumnSumsAvx512(double *columnSums, double *nonFiniteCounts,
+                      const double *entering, const double *leaving,
+                      double scale, double *means, int width) {
+  if (nonFiniteCounts != nullptr) {
+    slideColumnSumsVector<Double8, true>(columnSums, nonFiniteCounts, entering,
+                                         leaving, scale, means, width);
+  } else {
+    slideColumnSumsVector<Double8, false>(columnSums, nullptr, entering,
+                                          leaving, scale, means, width);
+  }
+}
+
+#endif
+
+void slideColumnSums(double *columnSums, double *nonFiniteCounts,
+                     const double *entering, const double *leaving,
+                     double scale, double *means, int width,
+                     KernelInstructionSet instructionSet) {
+  switch (instructionSet) {
+#ifdef BOX_FILTER_X86
+  case KernelInstructionSet::Avx2:
+    slideColumnSumsAvx2(columnSums, nonFiniteCounts, entering, leaving, scale,
+                        means, width);
+    return;
+  case KernelInstructionSet::Avx512:
+    slideColumnSumsAvx512(columnSums, nonFiniteCounts, entering, leaving,
+                          scale, means, width);
+    return;
+#endif
+  default:
+    if (nonFiniteCounts != nullptr) {
+      slideColumnSumsScalar<true>(columnSums, nonFiniteCounts, entering,
+                                  leaving, scale, means, 0, width);
+    } else {
+      slideColumnSumsScalar<false>(columnSums, nullptr, entering, leaving,
+                                   scale, means, 0, width);
+    }
+  }
+}
+
+// The row the vertical pass writes its means to. Only the overload for the
+// image type is used, whichever it is.
+[[maybe_unused]] double *doubleRow(double *output, std::vector<double> &) {
+  return output;
+}
+[[maybe_unused]] double *doubleRow(float *, std::vector<double> &buffer) {
+  return buffer.data();
+}
+
+// The horizontal means of one row, keeping a running sum along it. Returns
+// the sum every value entered.
+template <bool CountNonFinite>
+double boxFilterRow(const Scalar *values, int width, int left, int right,
+                    double *means) {
+  // Non-finite values are counted rather than summed, as in slideColumnSums.
+  double sum = 0.0;
+  int nonFiniteCount = 0;
+  auto enter = [&](Scalar value) {
+    if (!CountNonFinite || std::isfinite(value)) {
+      sum += value;
+    } else {
+      ++nonFiniteCount;
+    }
+  };
+  auto leave = [&](Scalar value) {
+    if (!CountNonFinite || std::isfinite(value)) {
+      sum -= value;
+    } else {
+      --nonFiniteCount;
+    }
+  };
+  for (int column = 0; column < std::min(right, width); ++column) {
+    enter(values[column]);
+  }
+  for (int column = 0; column < width; ++column) {
+    if (column + right < width) {
+      enter(values[column + right]);
+    }
+    if (column - left - 1 >= 0) {
+      leave(values[column - left - 1]);
+    }
+    int count =
+        std::min(width, column + right + 1) - std::max(0, column - left);
+    means[column] = nonFiniteCount > 0 ? notANumber : sum / count;
+  }
+  return sum;
+}
+
+} // namespace
+
+void boxFilterHorizontal(const Image &image, int windowWidth,
+                         BasicImage<double> &rowMeans, int firstRow,
+                         int lastRow) {
+  if (!rowMeans.hasSameDimensions(image)) {
+    throw std::runtime_error("The box filter rows and the image have "
+                             "different dimensions.");
+  }
+  const int width = image.width();
+  const int left = (windowWidth - 1) / 2;
+  const int right = windowWidth / 2;
+  for (int row = firstRow; row < lastRow; ++row) {
+    const Scalar *values = image.rowData(row);
+    double *means = rowMeans.rowData(row);
+    // Every value enters the running sum, and a non-finite value leaves it
+    // non-finite for good, so only rows whose sum ends up non-finite are
+    // filtered again counting their non-finite values.
+    double sum = boxFilterRow<false>(values, width, left, right, means);
+    if (!std::isfinite(sum)) {
+      boxFilterRow<true>(values, width, left, right, means);
+    }
+  }
+}
+
+void boxFilterVertical(const BasicImage<double> &rowMeans, int windowHeight,
+                       Image &filtered, int firstRow, int lastRow,
+                       KernelInstructionSet instructionSet) {
+  if (!filtered.hasSameDimensions(rowMeans)) {
+    throw std::runtime_error("The box filter rows and the image have "
+                             "different dimensions.");
+  }
+  const int width = rowMeans.width();
+  const int height = rowMeans.height();
+  const int up = (windowHeight - 1) / 2;
+  const int down = windowHeight / 2;
+
+  // The band is filtered with plain running sums first. Every row it reads
+  // enters the sums, and a non-finite mean leaves its column sum non-finite
+  // for good, so the band is only filtered again counting non-finite means
+  // if a column sum ends up non-finite.
+  std::vector<double> columnSums(width);
+  std::vector<double> nonFiniteCounts;
+  std::vector<double> primingMeans(width);
+  // Means are written straight into double images, and converted from a
+  // row of doubles otherwise.
+  std::vector<double> meanRow(std::is_same<Scalar, double>::value ? 0 : width);
+  for (;;) {
+    double *counts = nonFiniteCounts.empty() ? nullptr : nonFiniteCounts.data();
+    std::fill(columnSums.begin(), columnSums.end(), 0.0);
+
+    // The sums of the window of the row above firstRow, which the first
+    // slide turns into those of firstRow. The means the priming writes are
+    // not needed.
+    for (int row = std::max(0, firstRow - up - 1);
+         row < std::min(height, firstRow + down); ++row) {
+      slideColumnSums(columnSums.data(), counts, rowMeans.rowData(row),
+                      nullptr, 1.0, primingMeans.data(), width,
+                      instructionSet);
+    }
+
+    for (int row = firstRow; row < lastRow; ++row) {
+      const double *entering =
+          row + down < height ? rowMeans.rowData(row + down) : nullptr;
+      const double *leaving =
+          row - up - 1 >= 0 ? rowMeans.rowData(row - up - 1) : nullptr;
+      int count = std::min(height, row + down + 1) - std::max(0, row - up);
+      Scalar *output = filtered.rowData(row);
+      double *means = doubleRow(output, meanRow);
+      slideColumnSums(columnSums.data(), counts, entering, leaving,
+                      1.0 / count, means, width, instructionSet);
+      if (means != static_cast<void *>(output)) {
+        std::copy(meanRow.begin(), meanRow.end(), output);
+      }
+    }
+
+    if (counts != nullptr ||
+        std::all_of(columnSums.begin(), columnSums.end(),
+                    [](double sum) { return std::isfinite(sum); })) {
+      return;
+    }
+    nonFiniteCounts.assign(width, 0.0);
+  }
+}
+
+Image boxFilter(const Image &image, const LeafletWindow &window,
+                KernelInstructionSet instructionSet) {
+  BasicImage<double> rowMeans(image.width(), image.height());
+  boxFilterHorizontal(image, window.width, rowMeans, 0, image.height());
+  Image filtered(image.width(), image.height());
+  boxFilterVertical(rowMeans, window.height, filtered, 0, image.height(),
+                    instructionSet);
+  return filtered;
+}
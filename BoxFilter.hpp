@@ -0,0 +1,36 @@
+#ifndef BOX_FILTER
+#define BOX_FILTER
+
+#include "ConductanceKernel.hpp"
+#include "Image.hpp"
+#include "IntegralImage.hpp"
+
+// Replaces every pixel with the mean of the leaflet window centred on it,
+// with the window clipped to the image exactly as IntegralImage::mean clips
+// it. The filter is separable: a horizontal pass keeps a running sum along
+// each row, and a vertical pass keeps running sums of whole rows of those
+// means, vectorized across the columns. Both cost a few additions per pixel
+// whatever the window size.
+//
+// The passes work on bands of rows, so large images can be filtered by
+// several threads: fill every band of the horizontal pass, then every band
+// of the vertical pass. Sums are kept in double whatever the image type.
+//
+// Like IntegralImage, the filter leaves non-finite pixels out of its sums
+// and gives NaN for exactly the windows that hold one.
+
+// Fills rows [firstRow, lastRow) of rowMeans, which must have the dimensions
+// of the image, with the horizontal means of the image.
+void boxFilterHorizontal(const Image &, int windowWidth,
+                         BasicImage<double> &rowMeans, int firstRow,
+                         int lastRow);
+
+// Fills rows [firstRow, lastRow) of the filtered image, which must have the
+// dimensions of rowMeans, with the vertical means of rowMeans.
+void boxFilterVertical(const BasicImage<double> &rowMeans, int windowHeight,
+                       Image &filtered, int firstRow, int lastRow,
+                       KernelInstructionSet);
+
+Image boxFilter(const Image &, const LeafletWindow &, KernelInstructionSet);
+
+#endif
@@ -0,0 +1,535 @@
+#include "ConductanceKernel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONDUCTANCE_KERNEL_X86
+#endif
+
+double getSaturationValue(double pixelTemp) {
+  return saturationConstant *
+         std::exp(-saturationTemperature / (pixelTemp + 273.15));
+}
+
+namespace {
+
+// Exact values of wp every 0.01 C from -50 C to 150 C.
+class SaturationTable {
+public:
+  SaturationTable() : values(numberSteps + 1) {
+    for (int step = 0; step <= numberSteps; ++step) {
+      values[step] =
+          getSaturationValue(minimumTemperature + step / stepsPerDegree);
+    }
+  }
+
+  double lookUp(double pixelTemp) const {
+    double position = (pixelTemp - minimumTemperature) * stepsPerDegree;
+    // Written so that NaN also falls back to the exact formula.
+    if (!(position >= 0.0 && position < numberSteps)) {
+      return getSaturationValue(pixelTemp);
+    }
+    int step = static_cast<int>(position);
+    double fraction = position - step;
+    return values[step] + fraction * (values[step + 1] - values[step]);
+  }
+
+  // Vector version of lookUp. Vectors are passed by reference for the same
+  // reason as in vectorExp. The table is gathered a lane at a time, so each
+  // lane takes the step and fraction lookUp would, and gives exactly the
+  // same value.
+  template <typename T, typename Vector>
+  inline __attribute__((always_inline)) void lookUp(const Vector &pixelTemp,
+                                                    Vector &result) const {
+    const int lanes = sizeof(Vector) / sizeof(T);
+    if constexpr (std::is_same<T, float>::value) {
+      for (int lane = 0; lane < lanes; ++lane) {
+        result[lane] = lookUp(pixelTemp[lane]);
+      }
+    } else {
+      Vector position = (pixelTemp - minimumTemperature) * stepsPerDegree;
+      bool inTable = true;
+      for (int lane = 0; lane < lanes; ++lane) {
+        inTable &= position[lane] >= 0.0 && position[lane] < numberSteps;
+      }
+      if (!inTable) {
+        for (int lane = 0; lane < lanes; ++lane) {
+          result[lane] = lookUp(pixelTemp[lane]);
+        }
+        return;
+      }
+
+      // Positions are non-negative here, so truncating is the floor.
+      Vector fraction;
+      Vector lower;
+      Vector upper;
+      for (int lane = 0; lane < lanes; ++lane) {
+        int step = static_cast<int>(position[lane]);
+        fraction[lane] = position[lane] - step;
+        lower[lane] = values[step];
+        upper[lane] = values[step + 1];
+      }
+      result = lower + fraction * (upper - lower);
+    }
+  }
+
+private:
+  static constexpr double minimumTemperature = -50.0;
+  static constexpr double stepsPerDegree = 100.0;
+  static constexpr int numberSteps = 20000;
+  std::vector<double> values;
+};
+
+const SaturationTable &saturationTable() {
+  static const SaturationTable table;
+  return table;
+}
+
+} // namespace
+
+double getTabulatedSaturationValue(double pixelTemp) {
+  return saturationTable().lookUp(pixelTemp);
+}
+
+double getSaturationValue(double pixelTemp,
+                          SaturationEvaluation saturationEvaluation) {
+  if (saturationEvaluation == SaturationEvaluation::Table) {
+    return getTabulatedSaturationValue(pixelTemp);
+  }
+  return getSaturationValue(pixelTemp);
+}
+
+double getAirTempAtColumn(const ConductanceParameters &parameters,
+                          double column) {
+  return parameters.airTemps.second * (column / parameters.numberColumns) +
+         parameters.airTemps.first;
+}
+
+double calculatePixelConductance(const ConductanceParameters &parameters,
+                                 double kValue, double column,
+                                 double pixelTemp) {
+  double Ta = getAirTempAtColumn(parameters, column);
+  double Wp = getSaturationValue(pixelTemp, parameters.saturationEvaluation);
+
+  double numerator = parameters.rValue + kValue * (Ta - pixelTemp);
+  double denominator = latentHeatOfVaporization * (Wp - parameters.wa);
+  return numerator / denominator;
+}
+
+template <typename T>
+double kernelRelativeErrorBound(const ConductanceParameters &parameters,
+                                double kValue, double column,
+                                double pixelTemp) {
+  double Ta = getAirTempAtColumn(parameters, column);
+  double Wp = getSaturationValue(pixelTemp);
+  double numerator = std::fabs(parameters.rValue + kValue * (Ta - pixelTemp));
+  double wpAmplification = Wp / std::fabs(Wp - parameters.wa);
+
+  double ulps = 4.0 + 4.0 * wpAmplification;
+  if (!std::is_same<T, double>::value) {
+    double exponent = saturationTemperature / std::fabs(pixelTemp + 273.15);
+    double numeratorTerms =
+        std::fabs(parameters.rValue) +
+        kValue * (std::fabs(Ta) + std::fabs(parameters.airTemps.second) +
+                  std::fabs(Ta - pixelTemp));
+    ulps += 4.0 * exponent * wpAmplification + 4.0 * numeratorTerms / numerator;
+  }
+  return ulps * std::numeric_limits<T>::epsilon();
+}
+
+namespace {
+
+template <typename T>
+void calculateConductanceRowScalar(const ConductanceParameters &parameters,
+                                   const T *temperatures, const T *kValues,
+                                   T *conductances, int firstColumn,
+                                   int width) {
+  for (int column = firstColumn; column < width; ++column) {
+    conductances[column] = static_cast<T>(calculatePixelConductance(
+        parameters, kValues[column], column, temperatures[column]));
+  }
+}
+
+#ifdef CONDUCTANCE_KERNEL_X86
+
+typedef double Double4 __attribute__((vector_size(32)));
+typedef int64_t Int4 __attribute__((vector_size(32)));
+typedef double Double8 __attribute__((vector_size(64)));
+typedef int64_t Int8 __attribute__((vector_size(64)));
+typedef float Float8 __attribute__((vector_size(32)));
+typedef int32_t Int32x8 __attribute__((vector_size(32)));
+typedef float Float16 __attribute__((vector_size(64)));
+typedef int32_t Int32x16 __attribute__((vector_size(64)));
+
+// Written so that NaN lanes are outside.
+template <typename Vector, typename T>
+inline __attribute__((always_inline)) bool
+allLanesWithin(const Vector &x, T lowest, T highest) {
+  const int lanes = sizeof(Vector) / sizeof(T);
+  bool within = true;
+  for (int lane = 0; lane < lanes; ++lane) {
+    within &= x[lane] >= lowest && x[lane] <= highest;
+  }
+  return within;
+}
+
+// Each lane is evaluated in double and rounded to the type of the vector,
+// like the scalar kernel does.
+template <typename Vector>
+inline __attribute__((always_inline)) void exponentiateLanes(Vector &x) {
+  const int lanes = sizeof(Vector) / sizeof(x[0]);
+  for (int lane = 0; lane < lanes; ++lane) {
+    x[lane] = std::exp(static_cast<double>(x[lane]));
+  }
+}
+
+// Replaces x with exp(x). x is split into n * ln2 + r with |r| <= ln2/2,
+// exp(r) comes from its degree 13 Taylor polynomial, whose truncation error
+// is below 5e-18, and 2^n is built directly in the exponent bits. That only
+// works for x in [-708, 709], so a vector with a lane outside it, or a NaN
+// lane, is evaluated with std::exp a lane at a time, which overflows to inf,
+// goes subnormal and underflows to 0 exactly as the scalar kernel does.
+// Vectors are passed by reference to keep them out of the calling convention
+// of functions compiled without AVX.
+template <typename Vector, typename IntVector>
+inline __attribute__((always_inline)) void vectorExp(Vector &x) {
+  if (!allLanesWithin(x, -708.0, 709.0)) {
+    exponentiateLanes(x);
+    return;
+  }
+
+  const double roundingShift = 6755399441055744.0; // 1.5 * 2^52
+  const double log2e = 1.44269504088896338700e+00;
+  // ln2 split so that n * ln2High is exact for every n in range.
+  const double ln2High = 6.93147180369123816490e-01;
+  const double ln2Low = 1.90821492927058770002e-10;
+
+  // Adding 1.5 * 2^52 rounds to the nearest integer and leaves that integer
+  // in the low bits of the sum.
+  Vector shifted = x * log2e + roundingShift;
+  Vector n = shifted - roundingShift;
+  Vector r = (x - n * ln2High) - n * ln2Low;
+
+  Vector p = r * (1.0 / 6227020800.0) + 1.0 / 479001600.0;
+  p = p * r + 1.0 / 39916800.0;
+  p = p * r + 1.0 / 3628800.0;
+  p = p * r + 1.0 / 362880.0;
+  p = p * r + 1.0 / 40320.0;
+  p = p * r + 1.0 / 5040.0;
+  p = p * r + 1.0 / 720.0;
+  p = p * r + 1.0 / 120.0;
+  p = p * r + 1.0 / 24.0;
+  p = p * r + 1.0 / 6.0;
+  p = p * r + 0.5;
+  p = p * r + 1.0;
+  p = p * r + 1.0;
+
+  const int64_t roundingShiftBits = 0x4338000000000000;
+  IntVector exponent = (IntVector)shifted - roundingShiftBits;
+  IntVector scaleBits = (exponent + 1023) << 52;
+  x = p * (Vector)scaleBits;
+}
+
+// Float version of vectorExp, using the minimax polynomial of Cephes' expf,
+// which is accurate to about 1 ULP, for x in [-87, 88].
+template <typename Vector, typename IntVector>
+inline __attribute__((always_inline)) void vectorExpFloat(Vector &x) {
+  if (!allLanesWithin(x, -87.0f, 88.0f)) {
+    exponentiateLanes(x);
+    return;
+  }
+
+  const float roundingShift = 12582912.0f; // 1.5 * 2^23
+  const float log2e = 1.44269504f;
+  const float ln2High = 0.693359375f;
+  const float ln2Low = -2.12194440e-4f;
+
+  Vector shifted = x * log2e + roundingShift;
+  Vector n = shifted - roundingShift;
+  Vector r = (x - n * ln2High) - n * ln2Low;
+
+  Vector p = r * 1.9875691500e-4f + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * (r * r) + r + 1.0f;
+
+  const int32_t roundingShiftBits = 0x4B400000;
+  IntVector exponent = (IntVector)shifted - roundingShiftBits;
+  IntVector scaleBits = (exponent + 127) << 23;
+  x = p * (Vector)scaleBits;
+}
+
+template <typename T, typename Vector, typename IntVector>
+inline __attribute__((always_inline)) void
+calculateConductanceRowVector(const ConductanceParameters &parameters,
+                              const T *temperatures, const T *kValues,
+                              T *conductances, int width) {
+  const int lanes = sizeof(Vector) / sizeof(T);
+
+  Vector laneOffsets;
+  for (int lane = 0; lane < lanes; ++lane) {
+    laneOffsets[lane] = lane;
+  }
+
+  // The parameters in the precision of the image.
+  const T rValue = parameters.rValue;
+  const T wa = parameters.wa;
+  const T airTempAtLeft = parameters.airTemps.first;
+  const T airTempSlope = parameters.airTemps.second;
+  const T numberColumns = parameters.numberColumns;
+  const T latentHeat = latentHeatOfVaporization;
+  const T w0 = saturationConstant;
+  const T Tw = saturationTemperature;
+  const T kelvinOffset = 273.15;
+
+  const SaturationTable &table = saturationTable();
+  const bool useTable =
+      parameters.saturationEvaluation == SaturationEvaluation::Table;
+
+  int column = 0;
+  for (; column + lanes <= width; column += lanes) {
+    Vector pixelTemp;
+    Vector kValue;
+    std::memcpy(&pixelTemp, temperatures + column, sizeof(Vector));
+    std::memcpy(&kValue, kValues + column, sizeof(Vector));
+
+    Vector columns = laneOffsets + static_cast<T>(column);
+    Vector Ta = airTempSlope * (columns / numberColumns) + airTempAtLeft;
+    Vector Wp;
+    if (useTable) {
+      table.lookUp<T, Vector>(pixelTemp, Wp);
+    } else {
+      Wp = -Tw / (pixelTemp + kelvinOffset);
+      if constexpr (std::is_same<T, float>::value) {
+        vectorExpFloat<Vector, IntVector>(Wp);
+      } else {
+        vectorExp<Vector, IntVector>(Wp);
+      }
+      Wp = w0 * Wp;
+    }
+
+    Vector numerator = rValue + kValue * (Ta - pixelTemp);
+    Vector denominator = latentHeat * (Wp - wa);
+    Vector conductance = numerator / denominator;
+    std::memcpy(conductances + column, &conductance, sizeof(Vector));
+  }
+  calculateConductanceRowScalar(parameters, temperatures, kValues,
+                                conductances, column, width);
+}
+
+__attribute__((target("avx2"))) void
+calculateConductanceRowAvx2(const ConductanceParameters &parameters,
+                            const double *temperatures, const double *kValues,
+                            double *conductances, int width) {
+  calculateConductanceRowVector<double, Double4, Int4>(
+      parameters, temperatures, kValues, conductances, width);
+}
+
+__attribute__((target("avx2"))) void
+calculateConductanceRowAvx2(const ConductanceParameters &parameters,
+                            const float *temperatures, const float *kValues,
+                            float *conductances, int width) {
+  calculateConductanceRowVector<float, Float8, Int32x8>(
+      parameters, temperatures, kValues, conductances, width);
+}
+
+__attribute__((target("avx512f"))) void
+calculateConductanceRowAvx512(const ConductanceParameters &parameters,
+                              const double *temperatures,
+                              const double *kValues, double *conductances,
+                              int width) {
+  calculateConductanceRowVector<double, Double8, Int8>(
+      parameters, temperatures, kValues, conductances, width);
+}
+
+__attribute__((target("avx512f"))) void
+calculateConductanceRowAvx512(const ConductanceParameters &parameters,
+                              const float *temperatures, const float *kValues,
+                              float *conductances, int width) {
+  calculateConductanceRowVector<float, Float16, Int32x16>(
+      parameters, temperatures, kValues, conductances, width);
+}
+
+#endif
+
+} // namespace
+
+KernelInstructionSet bestKernelInstructionSet() {
+#ifdef CONDUCTANCE_KERNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return KernelInstructionSet::Avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return KernelInstructionSet::Avx2;
+  }
+#endif
+  return KernelInstructionSet::Scalar;
+}
+
+KernelInstructionSet parseKernelInstructionSet(const std::string &name) {
+  KernelInstructionSet instructionSet;
+  if (name == "auto") {
+    return bestKernelInstructionSet();
+  } else if (name == "scalar") {
+    instructionSet = KernelInstructionSet::Scalar;
+  } else if (name == "avx2") {
+    instructionSet = KernelInstructionSet::Avx2;
+  } else if (name == "avx512") {
+    instructionSet = KernelInstructionSet::Avx512;
+  } else {
+    throw std::runtime_error("Unknown conductance kernel: " + name);
+  }
+
+  // Each instruction set is a superset of the ones before it.
+  if (static_cast<int>(instructionSet) >
+      static_cast<int>(bestKernelInstructionSet())) {
+    throw std::runtime_error("This processor does not support the " + name +
+                             " conductance kernel.");
+  }
+  return instructionSet;
+}
+
+std::string kernelInstructionSetName(KernelInstructionSet instructionSet) {
+  switch (instructionSet) {
+  case KernelInstructionSet::Avx2:
+    return "avx2";
+  case KernelInstructionSet::Avx512:
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+template <typename T>
+void calculateConductanceRow(const ConductanceParameters &parameters,
+                             const T *temperatures, const T *kValues,
+                             T *conductances, int width,
+                             KernelInstructionSet instructionSet) {
+  switch (instructionSet) {
+#ifdef CONDUCTANCE_KERNEL_X86
+  case KernelInstructionSet::Avx2:
+    calculateConductanceRowAvx2(parameters, temperatures, kValues,
+                                conductances, width);
+    return;
+  case KernelInstructionSet::Avx512:
+    calculateConductanceRowAvx512(parameters, temperatures, kValues,
+                                  conductances, width);
+    return;
+#endif
+  default:
+    calculateConductanceRowScalar(parameters, temperatures, kValues,
+                                  conductances, 0, width);
+  }
+}
+
+template <typename T>
+void calculateConductanceRows(const ConductanceParameters &parameters,
+                              const BasicImage<T> &temperatures,
+                              const BasicImage<T> &kMatrix,
+                              BasicImage<T> &conductances, int firstRow,
+                              int lastRow,
+                              KernelInstructionSet instructionSet) {
+  if (kMatrix.width() < temperatures.width() ||
+      kMatrix.height() < temperatures.height()) {
+    throw std::out_of_range("The K matrix is smaller than the temperature "
+                            "image.");
+  }
+  if (!conductances.hasSameDimensions(temperatures)) {
+    throw std::runtime_error("The conductance image and the temperature image "
+                             "have different dimensions.");
+  }
+
+  for (int row = firstRow; row < lastRow; ++row) {
+    calculateConductanceRow(parameters, temperatures.rowData(row),
+                            kMatrix.rowData(row), conductances.rowData(row),
+                            temperatures.width(), instructionSet);
+  }
+}
+
+template <typename T>
+BasicImage<T> calculateConductanceImage(const ConductanceParameters &parameters,
+                                        const BasicImage<T> &temperatures,
+                                        const BasicImage<T> &kMatrix,
+                                        KernelInstructionSet instructionSet) {
+  BasicImage<T> conductanceImage(temperatures.width(), temperatures.height());
+  calculateConductanceRows(parameters, temperatures, kMatrix, conductanceImage,
+                           0, temperatures.height(), instructionSet);
+  return conductanceImage;
+}
+
+template double kernelRelativeErrorBound<double>(const ConductanceParameters &,
+                                                 double, double, double);
+template double kernelRelativeErrorBound<float>(const ConductanceParameters &,
+                                                double, double, double);
+template void calculateConductanceRow<double>(const ConductanceParameters &,
+                                              const double *, const double *,
+                                              double *, int,
+                                              KernelInstructionSet);
+template void calculateConductanceRow<float>(const ConductanceParameters &,
+                                             const float *, const float *,
+                                             float *, int,
+                                             KernelInstructionSet);
+template void calculateConductanceRows<double>(
+    const ConductanceParameters &, const BasicImage<double> &,
+    const BasicImage<double> &, BasicImage<double> &, int, int,
+    KernelInstructionSet);
+template void calculateConductanceRows<float>(const ConductanceParameters &,
+                                              const BasicImage<float> &,
+                                              const BasicImage<float> &,
+                                              BasicImage<float> &, int, int,
+                                              KernelInstructionSet);
+template BasicImage<double> calculateConductanceImage<double>(
+    const ConductanceParameters &, const BasicImage<double> &,
+    const BasicImage<double> &, KernelInstructionSet);
+template BasicImage<float> calculateConductanceImage<float>(
+    const ConductanceParameters &, const BasicImage<float> &,
+    const BasicImage<float> &, KernelInstructionSet);
+
+PrecisionComparison compareFloatWithDouble(
+    const ConductanceParameters &parameters, const Image &temperatures,
+    const Image &kMatrix, KernelInstructionSet instructionSet) {
+  BasicImage<double> doubleConductances = calculateConductanceImage(
+      parameters, BasicImage<double>(temperatures),
+      BasicImage<double>(kMatrix), instructionSet);
+  BasicImage<float> floatConductances = calculateConductanceImage(
+      parameters, BasicImage<float>(temperatures), BasicImage<float>(kMatrix),
+      instructionSet);
+
+  PrecisionComparison comparison = {0, 0.0, 0.0, 0.0};
+  double totalDifference = 0.0;
+  for (int row = 0; row < doubleConductances.height(); ++row) {
+    for (int column = 0; column < doubleConductances.width(); ++column) {
+      double expected = doubleConductances(row, column);
+      double difference =
+          std::fabs(floatConductances(row, column) - expected);
+      // Pixels whose double conductance is not finite have no error to
+      // speak of.
+      if (!std::isfinite(expected) || std::isnan(difference)) {
+        continue;
+      }
+      ++comparison.comparedPixels;
+      totalDifference += difference;
+      comparison.maximumAbsoluteDifference =
+          std::max(comparison.maximumAbsoluteDifference, difference);
+      if (expected != 0.0) {
+        comparison.maximumRelativeDifference =
+            std::max(comparison.maximumRelativeDifference,
+                     difference / std::fabs(expected));
+      }
+    }
+  }
+  if (comparison.comparedPixels > 0) {
+    comparison.meanAbsoluteDifference =
+        totalDifference / comparison.comparedPixels;
+  }
+  return comparison;
+}
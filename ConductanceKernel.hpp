@@ -0,0 +1,122 @@
+#ifndef CONDUCTANCE_KERNEL
+#define CONDUCTANCE_KERNEL
+
+#include "Image.hpp"
+#include <string>
+#include <utility>
+
+// Evaluates the stomatal conductance equation
+//
+//   g = ( R + K(Ta - Tp) ) / ( Lw * (wp - wa) )
+//
+// over whole rows of an image of double or float. Everything that is
+// constant for an image is resolved once into ConductanceParameters, so the
+// inner loop only touches the temperature and K matrix rows.
+//
+// The scalar kernel reproduces the per-pixel equation exactly, in double,
+// and rounds the result to the image type. The AVX2 and AVX-512 kernels
+// evaluate the same arithmetic in the same order (this file is compiled
+// without multiply-add contraction), but in the image type, and compute
+// exp(-Tw / T) with a vectorized polynomial instead of std::exp. In double,
+// their wp stays within 4 ULP of the scalar wp, so g stays within
+// 4 + 4 * wp / |wp - wa| ULP of the scalar g.
+//
+// The float kernels process twice as many pixels per instruction, but also
+// round the exponent -Tw / T and the air temperature Ta to float. The
+// exponent's error is multiplied by Tw / T, about 20, in wp, and the error
+// of Ta is not reduced when Ta - Tp cancels. Their g is within
+//
+//   ( 4 + 4 * (1 + Tw / T) * wp / |wp - wa|
+//       + 4 * (|R| + K * (|Ta| + |Ta slope| + |Ta - Tp|)) / |R + K(Ta - Tp)| )
+//   ULP
+//
+// of the scalar g, where T is in kelvin. Near 25 C, with Ta - Tp small next
+// to R / K, that is about 80 ULP or 1e-5; it grows without bound as
+// R + K(Ta - Tp) nears zero. kernelRelativeErrorBound evaluates these bounds
+// for a pixel.
+
+const double latentHeatOfVaporization = 40.68; // Lw
+const double saturationConstant = 6.57959e8;   // w0
+const double saturationTemperature = 4982.85;  // Tw
+
+enum class KernelInstructionSet { Scalar, Avx2, Avx512 };
+
+// How wp is evaluated. Exact evaluates the exponential for every pixel.
+// Table interpolates linearly between exact values tabulated every 0.01 C,
+// the resolution of the camera, from -50 C to 150 C, which takes the
+// division and the exponential out of the inner loop. Its relative error is
+// at most 1.2e-7, and temperatures outside the table are evaluated exactly.
+enum class SaturationEvaluation { Exact, Table };
+
+// The fastest instruction set supported by the processor.
+KernelInstructionSet bestKernelInstructionSet();
+KernelInstructionSet parseKernelInstructionSet(const std::string &);
+std::string kernelInstructionSetName(KernelInstructionSet);
+
+struct ConductanceParameters {
+  double rValue;
+  double wa;
+  // The air temperature at a column is
+  //   airTemps.second * (column / numberColumns) + airTemps.first
+  std::pair<double, double> airTemps;
+  double numberColumns;
+  SaturationEvaluation saturationEvaluation;
+};
+
+// w(p) = w0 * exp( -Tw / T(p) )
+double getSaturationValue(double pixelTemp);
+double getTabulatedSaturationValue(double pixelTemp);
+double getSaturationValue(double pixelTemp, SaturationEvaluation);
+
+double getAirTempAtColumn(const ConductanceParameters &, double column);
+
+// The conductance of a single pixel, evaluated exactly.
+double calculatePixelConductance(const ConductanceParameters &, double kValue,
+                                 double column, double pixelTemp);
+
+// The kernels below are defined for T = double and T = float.
+
+// How far, relative to the scalar g, the g of a vector kernel working in T
+// may be for the pixel. See the comment at the top of the file.
+template <typename T>
+double kernelRelativeErrorBound(const ConductanceParameters &, double kValue,
+                                double column, double pixelTemp);
+
+template <typename T>
+void calculateConductanceRow(const ConductanceParameters &,
+                             const T *temperatures, const T *kValues,
+                             T *conductances, int width, KernelInstructionSet);
+
+// Fills rows [firstRow, lastRow) of a conductance image that has the
+// dimensions of the temperature image. Rows are independent, so disjoint row
+// ranges can be filled concurrently. The K matrix must be at least as large
+// as the temperature image.
+template <typename T>
+void calculateConductanceRows(const ConductanceParameters &,
+                              const BasicImage<T> &temperatures,
+                              const BasicImage<T> &kMatrix,
+                              BasicImage<T> &conductances, int firstRow,
+                              int lastRow, KernelInstructionSet);
+
+template <typename T>
+BasicImage<T> calculateConductanceImage(const ConductanceParameters &,
+                                        const BasicImage<T> &temperatures,
+                                        const BasicImage<T> &kMatrix,
+                                        KernelInstructionSet);
+
+// How far a conductance image calculated in float is from the same image
+// calculated in double. Both start from the given images, so in a double
+// build the comparison includes rounding the inputs to float.
+struct PrecisionComparison {
+  size_t comparedPixels;
+  double maximumAbsoluteDifference;
+  double maximumRelativeDifference;
+  double meanAbsoluteDifference;
+};
+
+PrecisionComparison compareFloatWithDouble(const ConductanceParameters &,
+                                           const Image &temperatures,
+                                           const Image &kMatrix,
+                                           KernelInstructionSet);
+
+#endif
@@ -0,0 +1,104 @@
+#include "DirectoryIndex.hpp"
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+#include <utility>
+
+namespace {
+
+bool isTokenCharacter(char character) {
+  return std::isalnum(static_cast<unsigned char>(character)) != 0;
+}
+
+// The identifiers that spell out a run of tokens of the name starting at its
+// earliest token where any identifier does.
+std::vector<std::string>
+carriedIdentifiers(const std::string &name,
+                   const std::unordered_set<std::string> &identifiers) {
+  std::vector<std::pair<size_t, size_t>> tokens;
+  for (size_t i = 0; i < name.size();) {
+    if (!isTokenCharacter(name[i])) {
+      ++i;
+      continue;
+    }
+    size_t start = i;
+    while (i < name.size() && isTokenCharacter(name[i])) {
+      ++i;
+    }
+    tokens.push_back(std::make_pair(start, i));
+  }
+
+  std::vector<std::string> carried;
+  for (size_t first = 0; first < tokens.size() && carried.empty(); ++first) {
+    for (size_t last = first; last < tokens.size(); ++last) {
+      std::string run = name.substr(tokens[first].first,
+                                    tokens[last].second - tokens[first].first);
+      if (identifiers.count(run)) {
+        carried.push_back(run);
+      }
+    }
+  }
+  return carried;
+}
+
+} // namespace
+
+DirectoryIndex::DirectoryIndex(const boost::filesystem::path &directoryPath,
+                               const std::vector<std::string> &identifiers)
+    : directory(directoryPath) {
+  std::unordered_set<std::string> wantedIdentifiers(identifiers.begin(),
+                                                    identifiers.end());
+  for (auto &&identifier : wantedIdentifiers) {
+    files[identifier];
+  }
+
+  boost::filesystem::directory_iterator endItr;
+  for (boost::filesystem::directory_iterator itr(directory); itr != endItr;
+       ++itr) {
+    const boost::filesystem::path &path = itr->path();
+    std::string name = path.filename().string();
+    if (!boost::filesystem::is_regular_file(path) || name.empty() ||
+        name[0] == '.') {
+      continue;
+    }
+
+    std::vector<std::string> carried =
+        carriedIdentifiers(path.stem().string(), wantedIdentifiers);
+    if (carried.empty()) {
+      unmatched.push_back(path);
+    } else if (carried.size() > 1) {
+      ambiguous.push_back(std::make_pair(path, carried));
+    } else {
+      files[carried.front()].push_back(path);
+    }
+  }
+
+  for (auto &&entry : files) {
+    std::sort(entry.second.begin(), entry.second.end());
+  }
+  std::sort(unmatched.begin(), unmatched.end());
+  std::sort(ambiguous.begin(), ambiguous.end());
+}
+
+const std::vector<boost::filesystem::path> &
+DirectoryIndex::filesWithIdentifier(const std::string &identifier) const {
+  static const std::vector<boost::filesystem::path> noFiles;
+  auto location = files.find(identifier);
+  return location == files.end() ? noFiles : location->second;
+}
+
+void DirectoryIndex::reportProblems(std::ostream &output,
+                                    const std::string &description) const {
+  for (auto &&path : unmatched) {
+    output << "WARNING: " << path.filename().string() << " in the "
+           << description << " does not match any identifier." << std::endl;
+  }
+  for (auto &&file : ambiguous) {
+    output << "WARNING: " << file.first.filename().string() << " in the "
+           << description << " matches more than one identifier (";
+    for (size_t i = 0; i < file.second.size(); ++i) {
+      output << (i == 0 ? "" : ", ") << file.second[i];
+    }
+    output << ") and will not be used." << std::endl;
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef DIRECTORY_INDEX
+#define DIRECTORY_INDEX
+
+#include <boost/filesystem.hpp>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Maps identifiers to the files of a directory that carry them, built from a
+// single scan of the directory.
+//
+// A file name is split into tokens at every character that is not a letter
+// or a digit, and an identifier matches when it spells out one or more
+// consecutive tokens of the file's stem. A file carries the identifiers that
+// match at the earliest token where any does, so whatever comes before the
+// identifier, such as "img_" or a date, is skipped, and what follows it
+// cannot match too: "1-12.csv" carries 1 but not 12, and "img_12_a.csv"
+// never carries 1 or 2. Files that carry none of the identifiers are
+// unmatched, and files that carry more than one, such as "1_2.csv" when both
+// 1 and 1_2 are identifiers, are ambiguous; neither is returned by
+// filesWithIdentifier.
+class DirectoryIndex {
+public:
+  using AmbiguousFile =
+      std::pair<boost::filesystem::path, std::vector<std::string>>;
+
+  DirectoryIndex(const boost::filesystem::path &directory,
+                 const std::vector<std::string> &identifiers);
+
+  // The matching files, sorted by path.
+  const std::vector<boost::filesystem::path> &
+  filesWithIdentifier(const std::string &) const;
+
+  const std::vector<boost::filesystem::path> &unmatchedFiles() const {
+    return unmatched;
+  }
+  const std::vector<AmbiguousFile> &ambiguousFiles() const {
+    return ambiguous;
+  }
+
+  // Writes a warning for every unmatched or ambiguous file.
+  void reportProblems(std::ostream &, const std::string &description) const;
+
+private:
+  boost::filesystem::path directory;
+  std::unordered_map<std::string, std::vector<boost::filesystem::path>> files;
+  std::vector<boost::filesystem::path> unmatched;
+  std::vector<AmbiguousFile> ambiguous;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "DirectoryWatcher.hpp"
+#include <stdexcept>
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+DirectoryWatcher::DirectoryWatcher()
+    : descriptor(inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) {
+  if (descriptor < 0) {
+    throw std::runtime_error(std::string("Could not start inotify: ") +
+                             std::strerror(errno));
+  }
+}
+
+DirectoryWatcher::~DirectoryWatcher() { close(descriptor); }
+
+int DirectoryWatcher::watch(const boost::filesystem::path &directory) {
+  int watchDescriptor =
+      inotify_add_watch(descriptor, directory.string().c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                            IN_DELETE | IN_ONLYDIR);
+  if (watchDescriptor < 0) {
+    throw std::runtime_error("Could not watch " + directory.string() + ": " +
+                             std::strerror(errno));
+  }
+  return watchDescriptor;
+}
+
+std::vector<DirectoryWatcher::Change>
+DirectoryWatcher::wait(int timeoutMilliseconds) {
+  std::vector<Change> changes;
+  pollfd watched = {descriptor, POLLIN, 0};
+  int ready = poll(&watched, 1, timeoutMilliseconds);
+  if (ready < 0 && errno != EINTR) {
+    throw std::runtime_error(std::string("Could not wait for changes: ") +
+                             std::strerror(errno));
+  }
+  if (ready <= 0) {
+    return changes;
+  }
+
+  alignas(inotify_event) char buffer[16 * 1024];
+  for (;;) {
+    ssize_t length = read(descriptor, buffer, sizeof(buffer));
+    if (length <= 0) {
+      break;
+    }
+    for (char *next = buffer; next < buffer + length;) {
+      const inotify_event *event = reinterpret_cast<inotify_event *>(next);
+      if (event->mask & IN_Q_OVERFLOW) {
+        changes.push_back({-1, ""});
+      } else if (event->len > 0) {
+        changes.push_back({event->wd, event->name});
+      }
+      next += sizeof(inotify_event) + event->len;
+    }
+  }
+  return changes;
+}
+
+#else
+
+DirectoryWatcher::DirectoryWatcher() : descriptor(-1) {
+  throw std::runtime_error("Watching directories needs inotify, which this "
+                           "system does not have.");
+}
+
+DirectoryWatcher::~DirectoryWatcher() {}
+
+int DirectoryWatcher::watch(const boost::filesystem::path &) { return -1; }
+
+std::vector<DirectoryWatcher::Change> DirectoryWatcher::wait(int) {
+  return std::vector<Change>();
+}
+
+#endif
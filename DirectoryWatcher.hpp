@@ -0,0 +1,41 @@
+#ifndef DIRECTORY_WATCHER
+#define DIRECTORY_WATCHER
+
+#include <boost/filesystem.hpp>
+#include <string>
+#include <vector>
+
+// Reports the files written to, moved into, moved out of or removed from a
+// set of directories, through inotify. Files are reported once they are
+// closed after writing, so a reported file is never half written. Only
+// available on Linux; elsewhere the constructor throws.
+class DirectoryWatcher {
+public:
+  struct Change {
+    // The value watch() returned for the directory.
+    int directory;
+    std::string fileName;
+  };
+
+  DirectoryWatcher();
+  ~DirectoryWatcher();
+
+  DirectoryWatcher(const DirectoryWatcher &) = delete;
+  DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+  // Starts watching the directory, and returns the identifier its changes
+  // are reported with.
+  int watch(const boost::filesystem::path &directory);
+
+  // Waits until something changes or the timeout expires, and returns the
+  // changes. A negative timeout waits for as long as it takes. Also returns,
+  // with no changes, when a signal interrupts the wait. If changes were lost
+  // because too many happened at once, a change with directory -1 and no
+  // file name is returned in their place.
+  std::vector<Change> wait(int timeoutMilliseconds);
+
+private:
+  int descriptor;
+};
+
+#endif
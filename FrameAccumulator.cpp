@@ -0,0 +1,46 @@
+#include "FrameAccumulator.hpp"
+#include <cmath>
+
+FrameAccumulator::FrameAccumulator() : frameCount(0) {}
+
+void FrameAccumulator::add(const Image &frame) {
+  if (frameCount == 0) {
+    sum = BasicImage<double>(frame.width(), frame.height());
+    compensation = BasicImage<double>(frame.width(), frame.height());
+  } else if (!frame.hasSameDimensions(sum)) {
+    throw std::runtime_error(
+        "Error! The images being averaged have different dimensions.");
+  }
+
+  double *sums = sum.data();
+  double *corrections = compensation.data();
+  const Scalar *pixels = frame.data();
+  const size_t numberPixels = sum.size();
+  for (size_t i = 0; i < numberPixels; ++i) {
+    double pixel = pixels[i];
+    double total = sums[i] + pixel;
+    // Recover the low order bits lost by whichever operand was smaller.
+    corrections[i] += std::fabs(sums[i]) >= std::fabs(pixel)
+                          ? (sums[i] - total) + pixel
+                          : (pixel - total) + sums[i];
+    sums[i] = total;
+  }
+  ++frameCount;
+}
+
+Image FrameAccumulator::mean() const {
+  if (frameCount == 0) {
+    throw std::runtime_error(
+        "Error! There were no images to load that match the specifier given.");
+  }
+
+  Image average(sum.width(), sum.height());
+  Scalar *averages = average.data();
+  const double *sums = sum.data();
+  const double *corrections = compensation.data();
+  const size_t numberPixels = average.size();
+  for (size_t i = 0; i < numberPixels; ++i) {
+    averages[i] = (sums[i] + corrections[i]) / frameCount;
+  }
+  return average;
+}
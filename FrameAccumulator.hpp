@@ -0,0 +1,28 @@
+#ifndef FRAME_ACCUMULATOR
+#define FRAME_ACCUMULATOR
+
+#include "Image.hpp"
+
+// Streaming average of equally sized frames. Each frame is folded into a
+// running per-pixel sum as soon as it is added, so memory use does not
+// depend on the number of frames. The sums use Neumaier's compensated
+// summation, which keeps the mean accurate to within a rounding or two no
+// matter how many frames are averaged. The sums are always kept in double,
+// whatever type the frames are stored in.
+class FrameAccumulator {
+public:
+  FrameAccumulator();
+
+  void add(const Image &);
+  int count() const { return frameCount; }
+
+  // Throws if no frames have been added.
+  Image mean() const;
+
+private:
+  BasicImage<double> sum;
+  BasicImage<double> compensation;
+  int frameCount;
+};
+
+#endif
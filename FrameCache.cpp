@@ -0,0 +1,178 @@
+#include "FrameCache.hpp"
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace {
+
+const char cacheMagic[4] = {'T', '2', 'C', 'F'};
+const uint32_t cacheVersion = 1;
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;
+  int64_t sourceModified;
+  int32_t window[4];
+  uint32_t width;
+  uint32_t height;
+  uint32_t elementSize;
+  uint32_t pathLength;
+};
+
+void fillWindow(int32_t (&fields)[4], const CropWindow &window) {
+  fields[0] = window.topLeft.first;
+  fields[1] = window.topLeft.second;
+  fields[2] = window.bottomRight.first;
+  fields[3] = window.bottomRight.second;
+}
+
+} // namespace
+
+FrameCache::FrameCache(const CropWindow &cropWindow)
+    : window(cropWindow), reader(cropWindow) {}
+
+Image FrameCache::load(const boost::filesystem::path &source) const {
+  SourceStamp stamp = stampSource(source);
+  boost::filesystem::path cachePath = cachePathFor(source);
+
+  Image frame;
+  if (readCachedFrame(cachePath, source, stamp, frame)) {
+    return frame;
+  }
+  frame = reader.read(source);
+  writeCachedFrame(cachePath, source, stamp, frame);
+  return frame;
+}
+
+boost::filesystem::path
+FrameCache::cachePathFor(const boost::filesystem::path &source) const {
+  std::string name = source.filename().string() + "." +
+                     std::to_string(window.topLeft.first) + "_" +
+                     std::to_string(window.topLeft.second) + "_" +
+                     std::to_string(window.bottomRight.first) + "_" +
+                     std::to_string(window.bottomRight.second) + ".frame";
+  return source.parent_path() / ".frame_cache" / name;
+}
+
+FrameCache::SourceStamp
+FrameCache::stampSource(const boost::filesystem::path &source) const {
+  struct stat fileStatus;
+  if (stat(source.string().c_str(), &fileStatus) != 0) {
+    throw std::runtime_error("BAD INPUT FILE: " + source.string());
+  }
+  SourceStamp stamp;
+  stamp.size = static_cast<uint64_t>(fileStatus.st_size);
+#ifdef __APPLE__
+  const struct timespec &modified = fileStatus.st_mtimespec;
+#else
+  const struct timespec &modified = fileStatus.st_mtim;
+#endif
+  stamp.modified = static_cast<int64_t>(modified.tv_sec) * 1000000000 +
+                   modified.tv_nsec;
+  return stamp;
+}
+
+bool FrameCache::readCachedFrame(const boost::filesystem::path &cachePath,
+                                 const boost::filesystem::path &source,
+                                 const SourceStamp &stamp,
+                                 Image &frame) const {
+  std::ifstream cacheFile(cachePath.string(), std::ios::binary);
+  if (!cacheFile.is_open()) {
+    return false;
+  }
+
+  CacheHeader header;
+  if (!cacheFile.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+    return false;
+  }
+
+  int32_t expectedWindow[4];
+  fillWindow(expectedWindow, window);
+  const std::string sourceName = source.string();
+  if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+      header.version != cacheVersion || header.sourceSize != stamp.size ||
+      header.sourceModified != stamp.modified ||
+      std::memcmp(header.window, expectedWindow, sizeof(expectedWindow)) !=
+          0 ||
+      header.elementSize != sizeof(Scalar) ||
+      header.pathLength != sourceName.size()) {
+    return false;
+  }
+
+  // A corrupt header must not make us allocate more than the file holds.
+  boost::system::error_code error;
+  uint64_t cacheSize = boost::filesystem::file_size(cachePath, error);
+  if (error || cacheSize < sizeof(header) + header.pathLength) {
+    return false;
+  }
+  uint64_t pixelBytes = cacheSize - sizeof(header) - header.pathLength;
+  if (pixelBytes % sizeof(Scalar) != 0 ||
+      static_cast<uint64_t>(header.width) * header.height !=
+          pixelBytes / sizeof(Scalar)) {
+    return false;
+  }
+
+  std::string cachedName(header.pathLength, '\0');
+  if (!cacheFile.read(&cachedName[0], cachedName.size()) ||
+      cachedName != sourceName) {
+    return false;
+  }
+
+  Image cachedFrame(header.width, header.height);
+  if (!cacheFile.read(reinterpret_cast<char *>(cachedFrame.data()),
+                      cachedFrame.size() * sizeof(Scalar))) {
+    return false;
+  }
+  frame = std::move(cachedFrame);
+  return true;
+}
+
+void FrameCache::writeCachedFrame(const boost::filesystem::path &cachePath,
+                                  const boost::filesystem::path &source,
+                                  const SourceStamp &stamp,
+                                  const Image &frame) const {
+  CacheHeader header;
+  std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+  header.version = cacheVersion;
+  header.sourceSize = stamp.size;
+  header.sourceModified = stamp.modified;
+  fillWindow(header.window, window);
+  header.width = frame.width();
+  header.height = frame.height();
+  header.elementSize = sizeof(Scalar);
+  const std::string sourceName = source.string();
+  header.pathLength = sourceName.size();
+
+  // The cache is only an optimisation, so failing to write it (for example
+  // on a read-only share) is not an error. Frames are written to a private
+  // temporary file first so a reader never sees a partial cache file. Its
+  // name is random, as other threads and other processes, such as a second
+  // run over the same directory, may be caching the same frame.
+  boost::system::error_code error;
+  boost::filesystem::create_directories(cachePath.parent_path(), error);
+  if (error) {
+    return;
+  }
+  boost::filesystem::path temporaryPath = boost::filesystem::unique_path(
+      cachePath.string() + ".%%%%-%%%%-%%%%-%%%%.tmp", error);
+  if (error) {
+    return;
+  }
+  {
+    std::ofstream cacheFile(temporaryPath.string(), std::ios::binary);
+    cacheFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    cacheFile.write(sourceName.data(), sourceName.size());
+    cacheFile.write(reinterpret_cast<const char *>(frame.data()),
+                    frame.size() * sizeof(Scalar));
+    if (!cacheFile.good()) {
+      cacheFile.close();
+      boost::filesystem::remove(temporaryPath, error);
+      return;
+    }
+  }
+  boost::filesystem::rename(temporaryPath, cachePath, error);
+  if (error) {
+    boost::filesystem::remove(temporaryPath, error);
+  }
+}
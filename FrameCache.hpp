@@ -0,0 +1,56 @@
+#ifndef FRAME_CACHE
+#define FRAME_CACHE
+
+#include "FrameReader.hpp"
+#include "Image.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdint>
+
+// Binary sidecar cache of parsed and cropped frames.
+//
+// The cached copy of "<dir>/<name>" lives in "<dir>/.frame_cache/" and is
+// named after the source file and the crop window. Each cache file is a
+// fixed header followed by the raw pixels in row-major order, in the native
+// byte order of the machine that wrote it:
+//
+//   char     magic[4]        "T2CF"
+//   uint32_t version
+//   uint64_t sourceSize      size of the CSV in bytes
+//   int64_t  sourceModified  modification time of the CSV in nanoseconds
+//   int32_t  window[4]       left, top, right, bottom of the crop window
+//   uint32_t width, height
+//   uint32_t elementSize     bytes per pixel
+//   uint32_t pathLength      followed by the source path, unterminated
+//
+// A cache file is only used when every field still matches the source, so
+// editing, replacing or re-cropping a frame transparently re-parses it.
+class FrameCache {
+public:
+  explicit FrameCache(const CropWindow &);
+
+  // Returns the cropped frame stored at the path, reading the cached copy
+  // when it is still valid and refreshing it otherwise.
+  Image load(const boost::filesystem::path &) const;
+
+  boost::filesystem::path
+  cachePathFor(const boost::filesystem::path &source) const;
+
+private:
+  struct SourceStamp {
+    uint64_t size;
+    int64_t modified;
+  };
+
+  CropWindow window;
+  FrameReader reader;
+
+  SourceStamp stampSource(const boost::filesystem::path &) const;
+  bool readCachedFrame(const boost::filesystem::path &cachePath,
+                       const boost::filesystem::path &source,
+                       const SourceStamp &, Image &) const;
+  void writeCachedFrame(const boost::filesystem::path &cachePath,
+                        const boost::filesystem::path &source,
+                        const SourceStamp &, const Image &) const;
+};
+
+#endif
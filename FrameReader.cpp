@@ -0,0 +1,186 @@
+#include "FrameReader.hpp"
+#include "MappedFile.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Powers of ten that are exactly representable as doubles.
+const double exactPowersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                   1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                   1e18, 1e19, 1e20, 1e21, 1e22};
+
+const uint64_t largestExactInteger = uint64_t(1) << 53;
+
+bool isDigit(char character) { return character >= '0' && character <= '9'; }
+
+double parseWithStrtod(const char *begin, const char *end) {
+  std::string number(begin, end);
+  char *parsedEnd = nullptr;
+  double value = std::strtod(number.c_str(), &parsedEnd);
+  if (parsedEnd == number.c_str()) {
+    throw std::runtime_error("Unable to parse number '" + number + "'.");
+  }
+  return value;
+}
+
+} // namespace
+
+double parseDecimal(const char *begin, const char *end) {
+  const char *cursor = begin;
+  while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+    ++cursor;
+  }
+
+  bool negative = false;
+  if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+    negative = *cursor == '-';
+    ++cursor;
+  }
+
+  uint64_t mantissa = 0;
+  int significantDigits = 0;
+  int exponent = 0;
+  bool anyDigits = false;
+  bool truncated = false;
+
+  for (; cursor < end && isDigit(*cursor); ++cursor) {
+    anyDigits = true;
+    int digit = *cursor - '0';
+    if (mantissa == 0 && digit == 0) {
+      continue;
+    }
+    if (significantDigits < 19) {
+      mantissa = mantissa * 10 + digit;
+      ++significantDigits;
+    } else {
+      ++exponent;
+      truncated = true;
+    }
+  }
+
+  if (cursor < end && *cursor == '.') {
+    for (++cursor; cursor < end && isDigit(*cursor); ++cursor) {
+      anyDigits = true;
+      int digit = *cursor - '0';
+      if (mantissa == 0 && digit == 0) {
+        --exponent;
+        continue;
+      }
+      if (significantDigits < 19) {
+        mantissa = mantissa * 10 + digit;
+        ++significantDigits;
+        --exponent;
+      } else {
+        truncated = true;
+      }
+    }
+  }
+
+  if (!anyDigits) {
+    // Let strtod deal with "nan", "inf" and friends, or report the error.
+    return parseWithStrtod(begin, end);
+  }
+
+  if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+    const char *exponentStart = cursor + 1;
+    bool negativeExponent = false;
+    if (exponentStart < end &&
+        (*exponentStart == '-' || *exponentStart == '+')) {
+      negativeExponent = *exponentStart == '-';
+      ++exponentStart;
+    }
+    if (exponentStart < end && isDigit(*exponentStart)) {
+      int writtenExponent = 0;
+      for (cursor = exponentStart; cursor < end && isDigit(*cursor); ++cursor) {
+        if (writtenExponent < 100000) {
+          writtenExponent = writtenExponent * 10 + (*cursor - '0');
+        }
+      }
+      exponent += negativeExponent ? -writtenExponent : writtenExponent;
+    }
+  }
+
+  if (mantissa == 0) {
+    return negative ? -0.0 : 0.0;
+  }
+  if (truncated || mantissa > largestExactInteger || exponent < -22 ||
+      exponent > 22) {
+    return parseWithStrtod(begin, end);
+  }
+
+  // Both operands are exact, so the result is correctly rounded.
+  double value = static_cast<double>(mantissa);
+  if (exponent < 0) {
+    value /= exactPowersOfTen[-exponent];
+  } else {
+    value *= exactPowersOfTen[exponent];
+  }
+  return negative ? -value : value;
+}
+
+FrameReader::FrameReader(const CropWindow &cropWindow) : window(cropWindow) {}
+
+Image FrameReader::read(const boost::filesystem::path &path) const {
+  MappedFile file(path);
+  try {
+    return parse(file.begin(), file.end());
+  } catch (const std::runtime_error &error) {
+    throw std::runtime_error(path.string() + ": " + error.what());
+  }
+}
+
+Image FrameReader::parse(const char *begin, const char *end) const {
+  Image frame;
+  std::vector<double> rowValues;
+
+  int rowNumber = 0;
+  const char *lineStart = begin;
+  while (lineStart < end) {
+    const char *lineEnd =
+        static_cast<const char *>(memchr(lineStart, '\n', end - lineStart));
+    if (lineEnd == nullptr) {
+      lineEnd = end;
+    }
+
+    ++rowNumber;
+    if (rowNumber > window.bottomRight.second) {
+      break;
+    }
+    if (rowNumber >= window.topLeft.second) {
+      parseRow(lineStart, lineEnd, rowValues);
+      if (!rowValues.empty()) {
+        frame.appendRow(rowValues.data(), rowValues.size());
+      }
+    }
+    lineStart = lineEnd + 1;
+  }
+  return frame;
+}
+
+void FrameReader::parseRow(const char *lineStart, const char *lineEnd,
+                           std::vector<double> &rowValues) const {
+  rowValues.clear();
+
+  int columnNumber = 0;
+  const char *cellStart = lineStart;
+  while (cellStart < lineEnd) {
+    const char *cellEnd = static_cast<const char *>(
+        memchr(cellStart, ',', lineEnd - cellStart));
+    if (cellEnd == nullptr) {
+      cellEnd = lineEnd;
+    }
+
+    ++columnNumber;
+    if (columnNumber > window.bottomRight.first) {
+      break;
+    }
+    if (columnNumber >= window.topLeft.first) {
+      rowValues.push_back(parseDecimal(cellStart, cellEnd));
+    }
+    cellStart = cellEnd + 1;
+  }
+}
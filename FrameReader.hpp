@@ -0,0 +1,41 @@
+#ifndef FRAME_READER
+#define FRAME_READER
+
+#include "Image.hpp"
+#include <boost/filesystem.hpp>
+
+// The region of a raw frame that is kept when it is loaded. Rows and columns
+// are compared against the 1-based line and cell numbers of the file, so a
+// window covers the lines topLeft.second through bottomRight.second and the
+// cells topLeft.first through bottomRight.first.
+struct CropWindow {
+  Coordinate topLeft;
+  Coordinate bottomRight;
+};
+
+// Loads radiometric CSV exports. Lines above the crop window and cells to the
+// left of it are skipped by scanning the raw bytes for newlines and commas,
+// and scanning stops at the bottom of the window, so only the cells inside
+// the window are ever parsed.
+class FrameReader {
+public:
+  explicit FrameReader(const CropWindow &);
+
+  Image read(const boost::filesystem::path &) const;
+  Image parse(const char *begin, const char *end) const;
+
+private:
+  CropWindow window;
+
+  void parseRow(const char *lineStart, const char *lineEnd,
+                std::vector<double> &rowValues) const;
+};
+
+// Parses the decimal number at the start of [begin, end). Leading blanks and
+// anything following the number are ignored, mirroring std::stod, but the
+// locale is never consulted. Numbers with at most 19 significant digits and
+// a small exponent are converted exactly with a single rounding; anything
+// else falls back to std::strtod.
+double parseDecimal(const char *begin, const char *end);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef IMAGE
+#define IMAGE
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A pixel location given as (column, row).
+using Coordinate = std::pair<int, int>;
+
+// The type images are stored and processed in. Building with
+// TEMPERATURE_TO_CONDUCTANCE_FLOAT32 defined halves the memory every image
+// takes and doubles the width of the vector conductance kernels.
+#ifdef TEMPERATURE_TO_CONDUCTANCE_FLOAT32
+using Scalar = float;
+#else
+using Scalar = double;
+#endif
+
+// A lightweight, non-owning view over a single row of an image.
+template <typename T> class RowView {
+public:
+  RowView(T *rowStart, int rowLength) : start(rowStart), length(rowLength) {}
+
+  T *begin() const { return start; }
+  T *end() const { return start + length; }
+  T *data() const { return start; }
+  int size() const { return length; }
+  T &operator[](int column) const { return start[column]; }
+
+private:
+  T *start;
+  int length;
+};
+
+// A contiguous, row-major image of T. Every pixel of the image lives in a
+// single allocation; consecutive rows are `stride()` elements apart.
+template <typename T> class BasicImage {
+public:
+  using value_type = T;
+
+  BasicImage() : numberColumns(0), numberRows(0), rowStride(0) {}
+
+  BasicImage(int width, int height, T value = T())
+      : numberColumns(width), numberRows(height), rowStride(width),
+        pixels(static_cast<size_t>(width) * height, value) {
+    if (width < 0 || height < 0) {
+      throw std::runtime_error("Image dimensions must not be negative.");
+    }
+  }
+
+  // Copies an image of another type, converting every pixel.
+  template <typename U>
+  explicit BasicImage(const BasicImage<U> &other)
+      : BasicImage(other.width(), other.height()) {
+    for (int row = 0; row < numberRows; ++row) {
+      const U *values = other.rowData(row);
+      T *converted = rowData(row);
+      for (int column = 0; column < numberColumns; ++column) {
+        converted[column] = static_cast<T>(values[column]);
+      }
+    }
+  }
+
+  int width() const { return numberColumns; }
+  int height() const { return numberRows; }
+  int stride() const { return rowStride; }
+  size_t size() const {
+    return static_cast<size_t>(numberColumns) * numberRows;
+  }
+  bool empty() const { return numberRows == 0 || numberColumns == 0; }
+  template <typename U>
+  bool hasSameDimensions(const BasicImage<U> &other) const {
+    return numberColumns == other.width() && numberRows == other.height();
+  }
+
+  T *data() { return pixels.data(); }
+  const T *data() const { return pixels.data(); }
+
+  T *rowData(int row) {
+    return pixels.data() + static_cast<size_t>(row) * rowStride;
+  }
+  const T *rowData(int row) const {
+    return pixels.data() + static_cast<size_t>(row) * rowStride;
+  }
+
+  RowView<T> row(int row) { return RowView<T>(rowData(row), numberColumns); }
+  RowView<const T> row(int row) const {
+    return RowView<const T>(rowData(row), numberColumns);
+  }
+
+  // Unchecked pixel access.
+  T &operator()(int row, int column) { return rowData(row)[column]; }
+  T operator()(int row, int column) const { return rowData(row)[column]; }
+
+  // Bounds checked pixel access.
+  T &at(int row, int column) {
+    checkBounds(row, column);
+    return rowData(row)[column];
+  }
+  T at(int row, int column) const {
+    checkBounds(row, column);
+    return rowData(row)[column];
+  }
+
+  // Appends a row to the bottom of the image, converting the values to T.
+  // The first row appended to an empty image defines the width of the image.
+  template <typename U> void appendRow(const U *values, int count) {
+    if (numberRows == 0) {
+      numberColumns = count;
+      rowStride = count;
+    } else if (count != numberColumns) {
+      throw std::runtime_error("Image row has " + std::to_string(count) +
+                               " values, expected " +
+                               std::to_string(numberColumns) + ".");
+    }
+    pixels.insert(pixels.end(), values, values + count);
+    ++numberRows;
+  }
+
+private:
+  int numberColumns;
+  int numberRows;
+  int rowStride;
+  std::vector<T> pixels;
+
+  void checkBounds(int row, int column) const {
+    if (row < 0 || row >= numberRows || column < 0 || column >= numberColumns) {
+      throw std::out_of_range("Pixel (" + std::to_string(row) + ", " +
+                              std::to_string(column) +
+                              ") is outside of the image.");
+    }
+  }
+};
+
+using Image = BasicImage<Scalar>;
+
+#endif
@@ -1,13 +1,73 @@
 #include "ImageConverter.hpp"
+#include "DirectoryIndex.hpp"
+#include "FrameAccumulator.hpp"
+#include "BoundedQueue.hpp"
+#include "BoxFilter.hpp"
+#include "FrameCache.hpp"
+#include "InputManifest.hpp"
+#include "MapArchive.hpp"
+#include "NpyFile.hpp"
+#include "TimeSeriesStore.hpp"
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <math.h>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
+
+namespace {
+
+// Hidden entries (".DS_Store", ".frame_cache", ...) are never program data.
+bool isHiddenEntry(const Path &path) {
+  std::string name = path.filename().string();
+  return !name.empty() && name[0] == '.';
+}
+
+// The number of pixels in each band of rows that conductance maps are
+// calculated in.
+const int pixelsPerBand = 1 << 16;
+
+// A K matrix saved both as .npy and as .csv is read from the .npy file, which
+// loads faster; the .csv copy is left alone.
+std::vector<Path> preferredKMatrixFiles(const std::vector<Path> &files) {
+  std::vector<Path> npyFiles;
+  for (auto &&file : files) {
+    if (file.extension() == ".npy") {
+      npyFiles.push_back(file);
+    }
+  }
+  return npyFiles.empty() ? files : npyFiles;
+}
+
+} // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 /* CONSTRUCTOR */
 
-ImageConverter::ImageConverter(const Path &pathToBaseDirectory) {
+ImageConverter::ImageConverter(const Path &pathToBaseDirectory,
+                               const ConverterOptions &options)
+    : useFrameCache(options.useFrameCache),
+      threadPool(std::make_shared<ThreadPool>(options.workerCount)),
+      kernelInstructionSet(options.kernelInstructionSet),
+      saturationEvaluation(options.saturationEvaluation),
+      imageWriter(options.outputPrecision, options.outputFormat),
+      backgroundWrites(options.backgroundWrites),
+      packMapsIntoArchive(options.packMapsIntoArchive),
+      validatePrecision(options.validatePrecision),
+      createLeafletConductanceMaps(options.createLeafletConductanceMaps),
+      pixelQueries(options.pixelQueries),
+      buildTimeSeriesStore(options.buildTimeSeriesStore),
+      quiet(options.quiet), statistics(options.statistics),
+      recomputeChangedOnly(options.recomputeChangedOnly),
+      skipImagesWithoutFrames(options.skipImagesWithoutFrames),
+      kMatrixGroupCount(0),
+      kMatrixStore(std::make_shared<KMatrixStore>()),
+      leafletWindow(options.leafletWindow), numberColumns(0) {
   int choice = getProgramExecutionType();
   switch (choice) {
   case 1:
@@ -19,6 +79,55 @@ ImageConverter::ImageConverter(const Path &pathToBaseDirectory) {
   }
 }
 
+ImageConverter::ImageConverter(const Path &pathToBaseDirectory,
+                               const ConductanceJob &job,
+                               const ConverterOptions &options,
+                               std::shared_ptr<ThreadPool> sharedThreadPool,
+                               std::shared_ptr<KMatrixStore> sharedKMatrices)
+    : useFrameCache(options.useFrameCache),
+      threadPool(std::move(sharedThreadPool)),
+      kernelInstructionSet(options.kernelInstructionSet),
+      saturationEvaluation(options.saturationEvaluation),
+      imageWriter(options.outputPrecision, options.outputFormat),
+      backgroundWrites(options.backgroundWrites),
+      packMapsIntoArchive(options.packMapsIntoArchive),
+      validatePrecision(options.validatePrecision),
+      createLeafletConductanceMaps(options.createLeafletConductanceMaps),
+      pixelQueries(options.pixelQueries),
+      buildTimeSeriesStore(options.buildTimeSeriesStore),
+      quiet(options.quiet), statistics(options.statistics),
+      recomputeChangedOnly(options.recomputeChangedOnly),
+      skipImagesWithoutFrames(options.skipImagesWithoutFrames),
+      kMatrixGroupCount(0),
+      kMatrixStore(std::move(sharedKMatrices)),
+      leafletWindow(options.leafletWindow), numberColumns(0) {
+  runConductanceMapJob(pathToBaseDirectory, job);
+}
+
+ImageConverter::ImageConverter(const Path &pathToBaseDirectory,
+                               const std::vector<KMatrixJob> &jobs,
+                               const ConverterOptions &options,
+                               std::shared_ptr<ThreadPool> sharedThreadPool)
+    : useFrameCache(options.useFrameCache),
+      threadPool(std::move(sharedThreadPool)),
+      kernelInstructionSet(options.kernelInstructionSet),
+      saturationEvaluation(options.saturationEvaluation),
+      imageWriter(options.outputPrecision, options.outputFormat),
+      backgroundWrites(options.backgroundWrites),
+      packMapsIntoArchive(options.packMapsIntoArchive),
+      validatePrecision(options.validatePrecision),
+      createLeafletConductanceMaps(options.createLeafletConductanceMaps),
+      pixelQueries(options.pixelQueries),
+      buildTimeSeriesStore(options.buildTimeSeriesStore),
+      quiet(options.quiet), statistics(options.statistics),
+      recomputeChangedOnly(options.recomputeChangedOnly),
+      skipImagesWithoutFrames(options.skipImagesWithoutFrames),
+      kMatrixGroupCount(0),
+      kMatrixStore(std::make_shared<KMatrixStore>()),
+      leafletWindow(options.leafletWindow), numberColumns(0) {
+  runKMatrixJobs(pathToBaseDirectory, jobs);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* MAIN PROGRAM EXECUTION */
 
@@ -35,10 +144,94 @@ void ImageConverter::runConductanceMapCreationProgram(
   std::cout << "Starting Conductance Map Creation Program" << std::endl;
   initializeVariablesForConductanceMapProgram(pathToBaseDirectory);
   confirmConductanceMapVariableInitializationIsCorrect();
+  std::vector<std::string> pixelsToSummarize = askWhichPixelsToSummarize();
+  loadAllConductanceProgramData();
+  createConductanceMaps(!pixelsToSummarize.empty());
+  if (!pixelsToSummarize.empty()) {
+    createSelectedPixelsFile(pixelsToSummarize);
+  }
+}
+
+void ImageConverter::runConductanceMapJob(const Path &pathToBaseDirectory,
+                                          const ConductanceJob &job) {
+  std::cout << "Starting Conductance Map Creation Program for " << job.date
+            << std::endl;
+  date = job.date;
+  initializeConductanceMapPaths(pathToBaseDirectory);
+  rValue = job.rValue;
+  cropWindow = job.cropWindow;
   loadAllConductanceProgramData();
-  saveAverageTemperatureImages();
-  createConductanceMaps();
-  summarizeSelectedPixels();
+  createConductanceMaps(!job.pixelCoordinates.empty());
+  if (!job.pixelCoordinates.empty()) {
+    createSelectedPixelsFile(job.pixelCoordinates);
+  }
+}
+
+/* Creates the K matrix of every job. Jobs are grouped by crop window, and the
+frames of every directory of a group are loaded as one set of image groups,
+so directories are parsed in parallel with each other. Each directory keeps
+its own R value and air temperatures. */
+void ImageConverter::runKMatrixJobs(const Path &pathToBaseDirectory,
+                                    const std::vector<KMatrixJob> &jobs) {
+  std::cout << "Starting KMatrix Creation Program for " << jobs.size()
+            << " directories" << std::endl;
+  initializeVariablesForKMatrixProgram(pathToBaseDirectory);
+
+  // Every directory must have frames, and a name of its own, before any
+  // frame is parsed.
+  std::vector<Path> directories;
+  std::vector<std::vector<Path>> frameGroups;
+  std::set<std::string> kMatrixIds;
+  for (auto &&job : jobs) {
+    Path directory = job.directory.is_absolute()
+                         ? job.directory
+                         : kMatrixDirectory / job.directory;
+    std::string kMatrixId = directory.stem().generic_string();
+    if (!kMatrixIds.insert(kMatrixId).second) {
+      throw std::runtime_error("The K matrix of " + kMatrixId +
+                               " is listed twice.");
+    }
+    airTemps[kMatrixId] = loadAirTemperatures(
+        job.upperBeforeThermocouple, job.upperAfterThermocouple,
+        job.lowerBeforeThermocouple, job.lowerAfterThermocouple);
+    directories.push_back(directory);
+    frameGroups.push_back(findFilesInDirectory(directory));
+  }
+
+  AsyncImageWriter imagesToSave(
+      [this](const Path &fileName, const Image &image) {
+        saveImage(fileName, image);
+      },
+      backgroundWrites);
+  std::vector<bool> loaded(jobs.size(), false);
+  for (size_t first = 0; first < jobs.size(); ++first) {
+    if (loaded[first]) {
+      continue;
+    }
+    std::vector<size_t> jobsInWindow;
+    std::vector<std::vector<Path>> groupsInWindow;
+    for (size_t i = first; i < jobs.size(); ++i) {
+      const CropWindow &window = jobs[i].cropWindow;
+      if (window.topLeft == jobs[first].cropWindow.topLeft &&
+          window.bottomRight == jobs[first].cropWindow.bottomRight) {
+        jobsInWindow.push_back(i);
+        groupsInWindow.push_back(frameGroups[i]);
+        loaded[i] = true;
+      }
+    }
+
+    cropWindow = jobs[first].cropWindow;
+    loadAndAverageImageGroups(
+        groupsInWindow, [&](size_t group, Image average) {
+          size_t job = jobsInWindow[group];
+          std::string kMatrixId = directories[job].stem().generic_string();
+          imagesToSave.save(getKMatrixFileName(directories[job]),
+                            std::make_shared<const Image>(calculateKMatrix(
+                                kMatrixId, jobs[job].rValue, average)));
+          return true;
+        });
+  }
+  imagesToSave.finish();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -53,22 +246,27 @@ void ImageConverter::initializeVariablesForKMatrixProgram(
   programDataInputFile = Path(basePath + "KMatrix/DataExtraction.csv");
   temperatureImagesDirectory = Path(basePath + "KMatrix/"); // Shouldn't be used
   kMatrixDirectory = Path(basePath + "KMatrix/");
-  topLeftWindowCoordinate = convertExcelNumberToStandard("EX72");
-  bottomRightWindowCoordinate = convertExcelNumberToStandard("VN434");
+  cropWindow.topLeft = convertExcelNumberToStandard("EX72");
+  cropWindow.bottomRight = convertExcelNumberToStandard("VN434");
 }
 
 /* Conductance Map Program */
 void ImageConverter::initializeVariablesForConductanceMapProgram(
     const Path &pathToBaseDirectory) {
-  std::string basePath = pathToBaseDirectory.generic_string();
   getDateFromUser();
+  initializeConductanceMapPaths(pathToBaseDirectory);
+}
+
+void ImageConverter::initializeConductanceMapPaths(
+    const Path &pathToBaseDirectory) {
+  std::string basePath = pathToBaseDirectory.generic_string();
   baseSaveDirectory = Path(basePath + "Data/" + date + "/");
   programDataInputFile =
       Path(basePath + "Data/" + date + "/DataExtraction.csv");
   temperatureImagesDirectory = Path(basePath + "Data/" + date + "/TempImages/");
   kMatrixDirectory = Path(basePath + "KMatrix/");
-  topLeftWindowCoordinate = convertExcelNumberToStandard("EX72");
-  bottomRightWindowCoordinate = convertExcelNumberToStandard("VN434");
+  cropWindow.topLeft = convertExcelNumberToStandard("EX72");
+  cropWindow.bottomRight = convertExcelNumberToStandard("VN434");
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -151,9 +349,8 @@ void ImageConverter::confirmCropImageCoordinatesAreCorrect() {
     std::getline(std::cin, bottomRightCoordinate);
   }
 
-  topLeftWindowCoordinate = convertExcelNumberToStandard(topLeftCoordinate);
-  bottomRightWindowCoordinate =
-      convertExcelNumberToStandard(bottomRightCoordinate);
+  cropWindow.topLeft = convertExcelNumberToStandard(topLeftCoordinate);
+  cropWindow.bottomRight = convertExcelNumberToStandard(bottomRightCoordinate);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -205,8 +402,14 @@ bool ImageConverter::getYesNoResponseFromUser() {
 
 void ImageConverter::loadAllConductanceProgramData() {
   std::ifstream inputFile;
-  std::cout << "Loading file: " << programDataInputFile << std::endl;
+  if (!quiet) {
+    std::cout << "Loading file: " << programDataInputFile << "\n";
+  }
   inputFile.open(programDataInputFile.string());
+  if (!inputFile.is_open()) {
+    throw std::runtime_error("BAD INPUT FILE: " +
+                             programDataInputFile.string());
+  }
 
   std::string inputLine;
   while (!inputFile.eof()) {
@@ -226,11 +429,10 @@ void ImageConverter::parseInputFileLine(std::istringstream &rowToParse) {
   std::getline(rowToParse, data, ',');
   std::string imageIdentifier = data;
   // std::cout << "Identifier: " << imageIdentifier << std::endl;
-  loadTemperatureImagesWithIdentifier(imageIdentifier);
 
   // Get KMatrix image identifier
   std::getline(rowToParse, data, ',');
-  loadKMatrixWithIdentifier(imageIdentifier, data);
+  programDataRows.push_back(std::make_pair(imageIdentifier, data));
 
   // Read four thermocouple temperatures
   std::getline(rowToParse, data, ',');
@@ -255,137 +457,184 @@ void ImageConverter::parseInputFileLine(std::istringstream &rowToParse) {
   wa.insert(std::make_pair(imageIdentifier, std::stod(data)));
 }
 
-Image ImageConverter::loadImageFromFile(const Path &path) {
-  Image filesImage;
-
-  std::ifstream inputFile;
-  inputFile.open(path.string());
-  if (!inputFile.good()) {
-    std::cout << "BAD INPUT FILE: " << path << std::endl;
-  } else {
-    std::cout << "Loading file: " << path << std::endl;
+/* Finds the frames of every temperature image of the program data file, in
+identifier order, and of the K matrices they use that are not in the store
+yet. Each directory is scanned once. */
+ImageConverter::ProgramDataImages ImageConverter::findProgramDataImages() {
+  StageTimer timer(statistics.get(), RunStage::DirectoryScan);
+  if (!boost::filesystem::exists(temperatureImagesDirectory) ||
+      !boost::filesystem::is_directory(temperatureImagesDirectory)) {
+    throw std::runtime_error(
+        "The temperature directory specified does not exist.");
   }
 
-  int rowNumber = 0;
-  while (!inputFile.eof()) {
-    std::string inputLine;
-    std::getline(inputFile, inputLine);
-    ++rowNumber;
-    if (rowNumber < topLeftWindowCoordinate.second) {
-      continue;
-    } else if (rowNumber > bottomRightWindowCoordinate.second) {
-      break;
-    }
-    auto numbersInRow = parseImageFileRow(inputLine);
-    if (!numbersInRow.empty()) {
-      filesImage.push_back(numbersInRow);
-    }
+  // The first row of an identifier decides its K matrix.
+  std::map<std::string, std::string> kMatrixIdOfImage;
+  for (auto &&row : programDataRows) {
+    kMatrixIdOfImage.insert(row);
+  }
+  ProgramDataImages images;
+  for (auto &&ids : kMatrixIdOfImage) {
+    images.temperatureIds.push_back(ids.first);
+    images.kMatrixIds.push_back(ids.second);
   }
-  inputFile.close();
-  return filesImage;
-}
-
-std::vector<double>
-ImageConverter::parseImageFileRow(const std::string &inputLine) {
-  std::vector<double> numbersInRow;
 
-  if (!inputLine.empty()) {
-    std::istringstream rowToParse(inputLine);
+  DirectoryIndex temperatureIndex(temperatureImagesDirectory,
+                                  images.temperatureIds);
+  DirectoryIndex kMatrixIndex(kMatrixDirectory, images.kMatrixIds);
+  temperatureIndex.reportProblems(std::cout, "temperature images directory");
+  kMatrixIndex.reportProblems(std::cout, "K Matrix directory");
+  for (auto &&kMatrixId : images.kMatrixIds) {
+    images.kMatrixFiles[kMatrixId] =
+        preferredKMatrixFiles(kMatrixIndex.filesWithIdentifier(kMatrixId));
+  }
 
-    int columnNumber = 0;
-    for (std::string number; std::getline(rowToParse, number, ',');) {
-      ++columnNumber;
-      if (columnNumber < topLeftWindowCoordinate.first) {
-        continue;
-      } else if (columnNumber > bottomRightWindowCoordinate.first) {
-        break;
-      }
-      numbersInRow.push_back(std::stod(number));
+  // Each K matrix is only loaded once, however many images use it.
+  for (auto &&kMatrixId : kMatrixStore->missingIdentifiers(images.kMatrixIds)) {
+    const auto &kMatrixFiles = images.kMatrixFiles.at(kMatrixId);
+    if (kMatrixFiles.size() > 1) {
+      throw std::runtime_error("More than one K matrix file has the "
+                               "identifier " +
+                               kMatrixId + ".");
+    } else if (!kMatrixFiles.empty()) {
+      images.kMatrixIdsToLoad.push_back(kMatrixId);
+      images.frameGroups.push_back(kMatrixFiles);
     }
   }
-  return numbersInRow;
-}
-
-void ImageConverter::loadKMatrixWithIdentifier(const std::string &tempId,
-                                               const std::string &kMatrixId) {
-  // if (kMatrices.count(kMatrixId)) {
-  //   // Already loaded KMatrix with this id, don't need to load it again.
-  //   return;
-  // }
 
-  // We are potentially loading the same KMatrix multiple times. It's a waste of
-  // memory, but it isn't causing problems, so I'm just dealing with it
-  // for now.
-
-  boost::filesystem::directory_iterator end_itr;
-  for (boost::filesystem::directory_iterator itr(kMatrixDirectory);
-       itr != end_itr; ++itr) {
-    Path pathToFile = itr->path();
-    Path stemOfFile = pathToFile.stem();
-    // If it's not a directory and the path contains
-    if (is_regular_file(itr->path()) &&
-        stemOfFile.string().find(kMatrixId) != std::string::npos) {
-      kMatrices.insert(
-          ImagePair(tempId, loadImageFromFile(pathToFile.string())));
+  std::vector<std::string> temperatureIds, kMatrixIds;
+  temperatureIds.swap(images.temperatureIds);
+  kMatrixIds.swap(images.kMatrixIds);
+  for (size_t i = 0; i < temperatureIds.size(); ++i) {
+    const std::string &identifier = temperatureIds[i];
+    const auto &frames = temperatureIndex.filesWithIdentifier(identifier);
+    if (frames.empty() && skipImagesWithoutFrames) {
+      std::cout << "Waiting for the frames of image " + identifier + "\n";
+      continue;
+    } else if (frames.empty()) {
+      throw std::runtime_error("Error! There were no images to load that "
+                               "match the specifier given.");
+    }
+    if (!quiet) {
+      std::cout << "Loading images with identifier: " + identifier + "\n";
     }
+    images.temperatureIds.push_back(identifier);
+    images.kMatrixIds.push_back(kMatrixIds[i]);
+    images.frameGroups.push_back(frames);
   }
+  return images;
 }
 
-void ImageConverter::loadTemperatureImagesWithIdentifier(
-    const std::string &tempId) {
-
-  Path temperatureDirectory(temperatureImagesDirectory);
-
-  if (boost::filesystem::exists(temperatureDirectory) &&
-      boost::filesystem::is_directory(temperatureDirectory)) {
-    averageTemperatureImages.insert(ImagePair(
-        tempId,
-        getAndAverageImagesWithIdentifier(tempId, temperatureDirectory)));
+/* The bytes read are those of the frame file, whether it was parsed or read
+from the frame cache. */
+Image ImageConverter::loadImageFromFile(const Path &path, RunStage stage) {
+  if (!quiet) {
+    std::cout << "Loading file: " + path.string() + "\n";
+  }
+  StageTimer timer(statistics.get(), stage);
+  Image frame;
+  if (path.extension() == ".npy") {
+    frame = readNpy(path, cropWindow);
+  } else if (useFrameCache) {
+    frame = FrameCache(cropWindow).load(path);
   } else {
-    throw std::runtime_error(
-        "The temperature directory specified does not exist.");
+    frame = FrameReader(cropWindow).read(path);
   }
+  if (timer.enabled()) {
+    timer.addBytesRead(boost::filesystem::file_size(path));
+    timer.addPixels(frame.size());
+  }
+  return frame;
 }
 
-Image ImageConverter::getAndAverageImagesWithIdentifier(
-    const std::string &identifier, const Path &path) {
-  std::cout << "Loading images with identifier: " << identifier << std::endl;
-  std::vector<Image> images;
-  boost::filesystem::directory_iterator end_itr;
-  for (boost::filesystem::directory_iterator itr(path); itr != end_itr; ++itr) {
-    std::string pathToFile = itr->path().string();
-    // If it's not a directory and the path contains id
-    if (is_regular_file(itr->path()) &&
-        pathToFile.find(identifier) != std::string::npos) {
-      images.push_back(loadImageFromFile(pathToFile));
-    }
-  }
-  return averageImages(images);
+/* Parses every file of every group on the thread pool and returns the
+average image of each group. */
+std::vector<Image> ImageConverter::loadAndAverageImageGroups(
+    const std::vector<std::vector<Path>> &groups) {
+  std::vector<Image> averages(groups.size());
+  loadAndAverageImageGroups(groups, [&averages](size_t group, Image average) {
+    averages[group] = std::move(average);
+    return true;
+  });
+  return averages;
 }
 
-Image ImageConverter::averageImages(const std::vector<Image> &images) {
-  if (images.size() == 0) {
-    throw std::runtime_error(
-        "Error! There were no images to load that match the specifier given.");
+/* Parses every file of every group on the thread pool and hands the average
+image of each group to onAverage as soon as it is complete, which is in group
+order. Frames are folded into their group's average in the order they are
+listed, whichever thread parsed them, so the result is bit-identical to
+loading the files one at a time. Stops early if onAverage returns false. */
+void ImageConverter::loadAndAverageImageGroups(
+    const std::vector<std::vector<Path>> &groups,
+    const std::function<bool(size_t group, Image average)> &onAverage) {
+  std::vector<std::pair<size_t, Path>> files;
+  for (size_t group = 0; group < groups.size(); ++group) {
+    for (auto &&path : groups[group]) {
+      files.push_back(std::make_pair(group, path));
+    }
   }
 
-  if (images.size() == 1) {
-    return images.back();
-  }
+  std::vector<FrameAccumulator> accumulators(groups.size());
+  std::deque<std::pair<size_t, std::future<Image>>> framesInFlight;
 
-  Image resultantImage;
-  for (int row = 0; row < images[0].size(); ++row) {
-    std::vector<double> resultantImageRow;
-    for (int column = 0; column < images[0].at(row).size(); ++column) {
-      double sum = 0;
-      for (auto &&image : images) {
-        sum += image.at(row).at(column);
+  // Frames still being parsed use this converter, so they are always waited
+  // for before returning.
+  auto finishFramesInFlight = [this, &framesInFlight]() {
+    for (auto &&frame : framesInFlight) {
+      try {
+        threadPool->wait(frame.second);
+      } catch (...) {
+      }
+    }
+  };
+
+  // Only a few frames per worker are parsed ahead of the fold, which keeps
+  // memory bounded no matter how many files there are.
+  const size_t maximumFramesInFlight = 2 * threadPool->size();
+  size_t nextFile = 0;
+  bool keepGoing = true;
+  try {
+    while (keepGoing &&
+           (nextFile < files.size() || !framesInFlight.empty())) {
+      while (nextFile < files.size() &&
+             framesInFlight.size() < maximumFramesInFlight) {
+        Path path = files[nextFile].second;
+        RunStage stage = files[nextFile].first < kMatrixGroupCount
+                             ? RunStage::KMatrixLoad
+                             : RunStage::Parse;
+        auto frame = threadPool->submit(
+            [this, path, stage]() { return loadImageFromFile(path, stage); });
+        framesInFlight.push_back(
+            std::make_pair(files[nextFile].first, std::move(frame)));
+        ++nextFile;
+      }
+
+      size_t group = framesInFlight.front().first;
+      Image frame = threadPool->wait(framesInFlight.front().second);
+      framesInFlight.pop_front();
+      bool complete = false;
+      Image average;
+      {
+        StageTimer timer(statistics.get(), group < kMatrixGroupCount
+                                               ? RunStage::KMatrixLoad
+                                               : RunStage::Average);
+        timer.addPixels(frame.size());
+        accumulators[group].add(frame);
+        if (accumulators[group].count() == (int)groups[group].size()) {
+          complete = true;
+          average = accumulators[group].mean();
+          accumulators[group] = FrameAccumulator();
+        }
+      }
+      if (complete) {
+        keepGoing = onAverage(group, std::move(average));
       }
-      resultantImageRow.push_back(sum / images.size());
     }
-    resultantImage.push_back(resultantImageRow);
+  } catch (...) {
+    finishFramesInFlight();
+    throw;
   }
-  return resultantImage;
+  finishFramesInFlight();
 }
 
 std::pair<double, double> ImageConverter::loadAirTemperatures(
@@ -412,6 +661,57 @@ ImageConverter::convertExcelNumberToStandard(const std::string &number) {
   return Coordinate(rawXCoordinate, rawYCoordinate);
 }
 
+std::string
+ImageConverter::convertStandardToExcelNumber(const Coordinate &coordinate) {
+  std::string letters;
+  for (int column = coordinate.first + 1; column > 0;
+       column = (column - 1) / 26) {
+    letters.insert(letters.begin(), 'A' + (column - 1) % 26);
+  }
+  return letters + std::to_string(coordinate.second + 1);
+}
+
+std::vector<PixelQuery> ImageConverter::loadPixelQueries(const Path &path) {
+  std::ifstream inputFile(path.string());
+  if (!inputFile.is_open()) {
+    throw std::runtime_error("BAD INPUT FILE: " + path.string());
+  }
+
+  std::vector<PixelQuery> queries;
+  int lineNumber = 0;
+  for (std::string line; std::getline(inputFile, line);) {
+    ++lineNumber;
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream rowToParse(line);
+    std::vector<std::string> fields;
+    for (std::string field; rowToParse >> field;) {
+      fields.push_back(field);
+    }
+    if (fields.empty() || fields[0][0] == '#') {
+      continue;
+    }
+    try {
+      if (std::isdigit(static_cast<unsigned char>(fields[0][0]))) {
+        if (fields.size() != 2) {
+          throw std::runtime_error("Expected column,row but got: " + line);
+        }
+        Coordinate coordinate(std::stoi(fields[0]), std::stoi(fields[1]));
+        queries.push_back(
+            {convertStandardToExcelNumber(coordinate), coordinate});
+      } else {
+        for (auto &&field : fields) {
+          queries.push_back({field, convertExcelNumberToStandard(field)});
+        }
+      }
+    } catch (const std::exception &error) {
+      throw std::runtime_error(path.string() + ":" +
+                               std::to_string(lineNumber) + ": " +
+                               error.what());
+    }
+  }
+  return queries;
+}
+
 int ImageConverter::convertExcelXCoordinate(
     const std::string &excelXCoordinate) {
   int stringLength = excelXCoordinate.size();
@@ -440,88 +740,500 @@ int ImageConverter::getCharValue(char character) {
 // Create conductance maps
 // Creates and saves the conductance maps.
 
-void ImageConverter::createConductanceMaps() {
-  std::string fileName = baseSaveDirectory.generic_string() +
-                         "ConductanceImages/" + date + "_Conductance_";
-  Path dir(baseSaveDirectory.generic_string() + "ConductanceImages/");
-  boost::filesystem::create_directory(dir);
-  for (auto &&tempImagePair : averageTemperatureImages) {
-    Image conductanceImage =
-        createConductanceImage(tempImagePair.first, tempImagePair.second);
-    Path fullFileName = (fileName + tempImagePair.first + ".csv");
-    conductanceMaps.insert(
-        std::make_pair(tempImagePair.first, conductanceImage));
-    saveImage(fullFileName, conductanceImage);
+/* Loads, averages, calculates and saves the images of every identifier as a
+pipeline. The calling thread folds parsed frames into average images, one
+thread calculates their conductance maps and the image writer saves both,
+in the background unless told otherwise, as files or into the map archive of
+the date. Bounded queues between the stages let parsing, calculating and
+saving overlap while only a few images are in memory at once. */
+void ImageConverter::createConductanceMaps(bool keepAverageTemperatureImages) {
+  ProgramDataImages images = findProgramDataImages();
+
+  std::string averageFileName = baseSaveDirectory.generic_string() +
+                                "AverageTempImages/" + date + "_AverageTemp_";
+  std::string conductanceFileName = baseSaveDirectory.generic_string() +
+                                    "ConductanceImages/" + date +
+                                    "_Conductance_";
+  std::string leafletConductanceFileName =
+      baseSaveDirectory.generic_string() + "LeafletConductanceImages/" + date +
+      "_LeafletConductance_";
+
+  // The input manifest describes the map files, so it is left alone when the
+  // maps are archived instead.
+  InputManifest inputManifest;
+  Path inputManifestPath(baseSaveDirectory.generic_string() +
+                         "InputManifest.csv");
+  if (!packMapsIntoArchive) {
+    inputManifest = fingerprintInputs(images);
+  }
+  // The pixel summaries, time series and precision validation are made from
+  // every image of the date.
+  bool needsEveryImage = keepAverageTemperatureImages ||
+                         !pixelQueries.empty() || buildTimeSeriesStore ||
+                         validatePrecision;
+  if (recomputeChangedOnly && (packMapsIntoArchive || needsEveryImage)) {
+    std::cout << "Recomputing every image: archives, pixel summaries, time "
+                 "series and precision validation need all of them."
+              << std::endl;
+  } else if (recomputeChangedOnly) {
+    InputManifest previousManifest = loadInputManifest(inputManifestPath);
+    std::set<std::string> upToDate;
+    for (auto &&entry : inputManifest) {
+      const std::string &imageIdentifier = entry.first;
+      std::vector<std::string> maps = {averageFileName, conductanceFileName};
+      if (createLeafletConductanceMaps) {
+        maps.push_back(leafletConductanceFileName);
+      }
+      bool mapsExist = true;
+      for (auto &&map : maps) {
+        mapsExist = mapsExist &&
+                    boost::filesystem::exists(
+                        Path(map + imageIdentifier + imageWriter.extension()));
+      }
+      auto previous = previousManifest.find(imageIdentifier);
+      if (mapsExist && previous != previousManifest.end() &&
+          previous->second == entry.second) {
+        upToDate.insert(imageIdentifier);
+      }
+    }
+    std::cout << upToDate.size() << " of " << inputManifest.size()
+              << " images are up to date." << std::endl;
+    removeImages(images, upToDate);
+  }
+  kMatrixGroupCount = images.kMatrixIdsToLoad.size();
+
+  // Archived maps are named after the files they replace.
+  // Archives and time series are float32 if the maps are saved as float32.
+  const int elementSize = imageWriter.format() == ImageFormat::NpyFloat32
+                              ? sizeof(float)
+                              : sizeof(double);
+  std::unique_ptr<MapArchiveWriter> archive;
+  Path archivePath(baseSaveDirectory.generic_string() + date + "_Maps.t2ca");
+  std::unique_ptr<TimeSeriesWriter> timeSeries;
+  Path timeSeriesPath(baseSaveDirectory.generic_string() + date +
+                      "_TimeSeries.t2cs");
+  if (buildTimeSeriesStore) {
+    timeSeries.reset(new TimeSeriesWriter(
+        timeSeriesPath, {"Temperature", "Conductance"}, elementSize));
+  }
+  if (packMapsIntoArchive) {
+    archive.reset(new MapArchiveWriter(archivePath, elementSize));
+  } else {
+    boost::filesystem::create_directory(
+        Path(baseSaveDirectory.generic_string() + "AverageTempImages/"));
+    boost::filesystem::create_directory(
+        Path(baseSaveDirectory.generic_string() + "ConductanceImages/"));
+    if (createLeafletConductanceMaps) {
+      boost::filesystem::create_directory(Path(
+          baseSaveDirectory.generic_string() + "LeafletConductanceImages/"));
+    }
+  }
+
+  // The bulk pixel query is answered an image at a time as the maps are
+  // created, so the average images need not be kept for it.
+  std::ofstream pixelTableFile;
+  std::string pixelTable;
+  Path pixelTablePath(baseSaveDirectory.generic_string() + "PixelTable.csv");
+  if (!pixelQueries.empty()) {
+    pixelTableFile.open(pixelTablePath.string(), std::ios::binary);
+    if (!pixelTableFile.is_open()) {
+      throw std::runtime_error("ERROR OPENING FILE: " +
+                               pixelTablePath.string());
+    }
+    pixelTableFile << "Image identifier,Excel coordinate,Column,Row,Wa,Pixel "
+                      "temp,Pixel delta w,Pixel conductance,Leaflet temp,"
+                      "Leaflet delta w,Leaflet conductance\n";
+  }
+
+  BoundedQueue<std::pair<std::string, SharedImage>> averageImages(2);
+  AsyncImageWriter imagesToSave(
+      [this, &archive, elementSize](const Path &fileName, const Image &image) {
+        if (archive) {
+          if (!quiet) {
+            std::cout << "Archiving map: " + fileName.stem().string() + "\n";
+          }
+          StageTimer timer(statistics.get(), RunStage::Save);
+          timer.addBytesWritten(uint64_t(image.size()) * elementSize);
+          timer.addPixels(image.size());
+          archive->add(fileName.stem().string(), image);
+        } else {
+          saveImage(fileName, image);
+        }
+      },
+      backgroundWrites);
+
+  std::mutex errorMutex;
+  std::exception_ptr firstError;
+  auto recordError = [&errorMutex, &firstError]() {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!firstError) {
+      firstError = std::current_exception();
+    }
+  };
+
+  std::thread conductanceStage([&]() {
+    try {
+      std::pair<std::string, SharedImage> average;
+      while (averageImages.pop(average)) {
+        const std::string &imageIdentifier = average.first;
+        imagesToSave.save(Path(averageFileName + imageIdentifier +
+                               imageWriter.extension()),
+                          average.second);
+        SharedImage conductanceImage = std::make_shared<const Image>(
+            createConductanceImage(imageIdentifier, *average.second));
+        imagesToSave.save(Path(conductanceFileName + imageIdentifier +
+                               imageWriter.extension()),
+                          conductanceImage);
+        if (timeSeries) {
+          StageTimer timer(statistics.get(), RunStage::Save);
+          timer.addBytesWritten(2 * uint64_t(conductanceImage->size()) *
+                                elementSize);
+          timeSeries->add(imageIdentifier,
+                          {average.second.get(), conductanceImage.get()});
+        }
+        if (createLeafletConductanceMaps) {
+          imagesToSave.save(
+              Path(leafletConductanceFileName + imageIdentifier +
+                   imageWriter.extension()),
+              std::make_shared<const Image>(createLeafletConductanceImage(
+                  imageIdentifier, *average.second)));
+        }
+        if (validatePrecision) {
+          comparePrecision(imageIdentifier, *average.second);
+        }
+        if (!pixelQueries.empty()) {
+          StageTimer timer(statistics.get(), RunStage::PixelSummary);
+          pixelTable.clear();
+          appendPixelTableRows(imageIdentifier, *average.second, pixelTable);
+          pixelTableFile.write(pixelTable.data(), pixelTable.size());
+          timer.addBytesWritten(pixelTable.size());
+          timer.addPixels(pixelQueries.size());
+        }
+      }
+    } catch (...) {
+      recordError();
+    }
+    // Also stops loading if this stage stopped early.
+    averageImages.close();
+  });
+
+  const size_t firstTemperatureGroup = images.kMatrixIdsToLoad.size();
+  try {
+    loadAndAverageImageGroups(
+        images.frameGroups, [&](size_t group, Image average) {
+          if (group < firstTemperatureGroup) {
+            kMatrixStore->insert(images.kMatrixIdsToLoad[group],
+                                 std::move(average));
+            return true;
+          }
+          // The K matrices come first, so they are all loaded by now.
+          if (group == firstTemperatureGroup) {
+            linkKMatrices(images);
+            numberColumns = average.width();
+          }
+          const std::string &imageIdentifier =
+              images.temperatureIds[group - firstTemperatureGroup];
+          SharedImage averageImage =
+              std::make_shared<const Image>(std::move(average));
+          if (keepAverageTemperatureImages) {
+            averageTemperatureImages.insert(
+                ImagePair(imageIdentifier, *averageImage));
+          }
+          return averageImages.push(
+              std::make_pair(imageIdentifier, averageImage));
+        });
+  } catch (...) {
+    recordError();
+  }
+  kMatrixGroupCount = 0;
+  averageImages.close();
+  conductanceStage.join();
+  try {
+    imagesToSave.finish();
+  } catch (...) {
+    recordError();
+  }
+  if (firstError) {
+    std::rethrow_exception(firstError);
+  }
+  if (archive) {
+    if (!quiet) {
+      std::cout << "Saving file: \"" + archivePath.string() + "\"\n";
+    }
+    StageTimer timer(statistics.get(), RunStage::Save);
+    archive->close();
+  }
+  if (timeSeries) {
+    if (!quiet) {
+      std::cout << "Saving file: \"" + timeSeriesPath.string() + "\"\n";
+    }
+    StageTimer timer(statistics.get(), RunStage::Save);
+    timeSeries->close();
+    if (timer.enabled()) {
+      timer.addBytesWritten(boost::filesystem::file_size(timeSeriesPath));
+    }
+  }
+  if (validatePrecision) {
+    savePrecisionValidation();
+  }
+  if (!pixelQueries.empty()) {
+    if (!quiet) {
+      std::cout << "Saving file: " + pixelTablePath.string() + "\n";
+    }
+    pixelTableFile.close();
+    if (pixelTableFile.fail()) {
+      throw std::runtime_error("ERROR WRITING FILE: " +
+                               pixelTablePath.string());
+    }
+  }
+  // Only saved once every map is, so that maps left half written by a failed
+  // run are never taken to be up to date.
+  if (!packMapsIntoArchive) {
+    if (!quiet) {
+      std::cout << "Saving file: " + inputManifestPath.string() + "\n";
+    }
+    saveInputManifest(inputManifestPath, inputManifest);
+  }
+}
+
+/* Fingerprints the inputs of every temperature image: its frames, the files
+of its K matrix, its program data row, and the settings of the run that
+change its maps. Files are fingerprinted by their size and modification time,
+so nothing is read. */
+InputManifest ImageConverter::fingerprintInputs(
+    const ProgramDataImages &images) {
+  StageTimer timer(statistics.get(), RunStage::DirectoryScan);
+  Fingerprint settings;
+  settings.addInteger(sizeof(Scalar));
+  settings.addInteger(rValue);
+  settings.addInteger(cropWindow.topLeft.first);
+  settings.addInteger(cropWindow.topLeft.second);
+  settings.addInteger(cropWindow.bottomRight.first);
+  settings.addInteger(cropWindow.bottomRight.second);
+  settings.addInteger(static_cast<int>(imageWriter.format()));
+  settings.addInteger(imageWriter.precision());
+  settings.addInteger(static_cast<int>(saturationEvaluation));
+  settings.addInteger(createLeafletConductanceMaps);
+  settings.addInteger(leafletWindow.width);
+  settings.addInteger(leafletWindow.height);
+
+  InputManifest manifest;
+  const size_t firstTemperatureGroup = images.kMatrixIdsToLoad.size();
+  for (size_t i = 0; i < images.temperatureIds.size(); ++i) {
+    const std::string &imageIdentifier = images.temperatureIds[i];
+    const std::string &kMatrixId = images.kMatrixIds[i];
+    Fingerprint frames;
+    for (auto &&frame : images.frameGroups[firstTemperatureGroup + i]) {
+      frames.addFileStamp(frame);
+    }
+    Fingerprint kMatrix;
+    for (auto &&kMatrixFile : images.kMatrixFiles.at(kMatrixId)) {
+      kMatrix.addFileStamp(kMatrixFile);
+    }
+    Fingerprint programData;
+    programData.add(kMatrixId);
+    programData.addNumber(airTemps.at(imageIdentifier).first);
+    programData.addNumber(airTemps.at(imageIdentifier).second);
+    programData.addNumber(wa.at(imageIdentifier));
+    manifest[imageIdentifier] = {frames.hex(), kMatrix.hex(),
+                                 programData.hex(), settings.hex()};
+  }
+  return manifest;
+}
+
+// Leaves out the images with the given identifiers, and the K matrices only
+// they would have loaded.
+void ImageConverter::removeImages(ProgramDataImages &images,
+                                  const std::set<std::string> &identifiers) {
+  const size_t firstTemperatureGroup = images.kMatrixIdsToLoad.size();
+  ProgramDataImages remaining;
+  std::set<std::string> kMatrixIdsUsed;
+  for (size_t i = 0; i < images.temperatureIds.size(); ++i) {
+    if (!identifiers.count(images.temperatureIds[i])) {
+      remaining.temperatureIds.push_back(images.temperatureIds[i]);
+      remaining.kMatrixIds.push_back(images.kMatrixIds[i]);
+      kMatrixIdsUsed.insert(images.kMatrixIds[i]);
+    }
+  }
+  for (size_t group = 0; group < firstTemperatureGroup; ++group) {
+    if (kMatrixIdsUsed.count(images.kMatrixIdsToLoad[group])) {
+      remaining.kMatrixIdsToLoad.push_back(images.kMatrixIdsToLoad[group]);
+      remaining.frameGroups.push_back(images.frameGroups[group]);
+    }
+  }
+  for (size_t i = 0; i < images.temperatureIds.size(); ++i) {
+    if (!identifiers.count(images.temperatureIds[i])) {
+      remaining.frameGroups.push_back(
+          images.frameGroups[firstTemperatureGroup + i]);
+    }
+  }
+  remaining.kMatrixFiles = std::move(images.kMatrixFiles);
+  images = std::move(remaining);
+}
+
+// Gives every temperature image the K matrix of its program data row.
+void ImageConverter::linkKMatrices(const ProgramDataImages &images) {
+  for (size_t i = 0; i < images.temperatureIds.size(); ++i) {
+    SharedImage kMatrix = kMatrixStore->find(images.kMatrixIds[i]);
+    if (kMatrix) {
+      kMatrices.insert(std::make_pair(images.temperatureIds[i], kMatrix));
+    }
   }
 }
 
 // Creates a particular conductance map.
-Image ImageConverter::createConductanceImage(std::string imageIdentifier,
+Image ImageConverter::createConductanceImage(const std::string &imageIdentifier,
                                              const Image &tempImage) {
-  Image conductanceImage;
-  for (int row = 0; row < tempImage.size(); ++row) {
-    std::vector<double> newRow;
-    for (int column = 0; column < tempImage.at(row).size(); ++column) {
-      newRow.push_back(calculateConductance(imageIdentifier, row, column,
-                                            tempImage.at(row).at(column)));
-      // std::cout << "(" << row << "," << column << ") , ";
-    }
-    conductanceImage.push_back(newRow);
-    // std::cout << std::endl;
+  auto it = kMatrices.find(imageIdentifier);
+  if (it == kMatrices.end()) {
+    throw std::runtime_error("Temperature image " + imageIdentifier +
+                             " does not have corresponding KMatrix.");
+  }
+  StageTimer timer(statistics.get(), RunStage::Conductance);
+  timer.addPixels(tempImage.size());
+  return calculateConductanceInBands(getConductanceParameters(imageIdentifier),
+                                     tempImage, *it->second);
+}
+
+// Creates the conductance map of the leaflet around every pixel: the
+// conductance of the mean temperature and mean K of each leaflet window, the
+// same value getLeafletConductance gives for a single pixel.
+Image ImageConverter::createLeafletConductanceImage(
+    const std::string &imageIdentifier, const Image &tempImage) {
+  auto it = kMatrices.find(imageIdentifier);
+  if (it == kMatrices.end()) {
+    throw std::runtime_error("Temperature image " + imageIdentifier +
+                             " does not have corresponding KMatrix.");
   }
+  StageTimer timer(statistics.get(), RunStage::Conductance);
+  timer.addPixels(tempImage.size());
+  auto smoothedKMatrix = smoothedKMatrices.find(it->second.get());
+  if (smoothedKMatrix == smoothedKMatrices.end()) {
+    smoothedKMatrix =
+        smoothedKMatrices
+            .insert(std::make_pair(it->second.get(),
+                                   smoothImage(*it->second)))
+            .first;
+  }
+  return calculateConductanceInBands(getConductanceParameters(imageIdentifier),
+                                     smoothImage(tempImage),
+                                     smoothedKMatrix->second);
+}
+
+// Large images are split into bands of rows so that a single image can also
+// use the whole pool.
+Image ImageConverter::calculateConductanceInBands(
+    const ConductanceParameters &parameters, const Image &tempImage,
+    const Image &kMatrix) {
+  Image conductanceImage(tempImage.width(), tempImage.height());
+  threadPool->parallelFor(
+      tempImage.height(), pixelsPerBand / std::max(1, tempImage.width()),
+      [&](int firstRow, int lastRow) {
+        calculateConductanceRows(parameters, tempImage, kMatrix,
+                                 conductanceImage, firstRow, lastRow,
+                                 kernelInstructionSet);
+      });
   return conductanceImage;
 }
 
+// Box filters the image over the leaflet window, in bands like the
+// conductance maps.
+Image ImageConverter::smoothImage(const Image &image) {
+  const int rowsPerBand = pixelsPerBand / std::max(1, image.width());
+  BasicImage<double> rowMeans(image.width(), image.height());
+  threadPool->parallelFor(image.height(), rowsPerBand,
+                          [&](int firstRow, int lastRow) {
+                            boxFilterHorizontal(image, leafletWindow.width,
+                                                rowMeans, firstRow, lastRow);
+                          });
+  Image smoothedImage(image.width(), image.height());
+  threadPool->parallelFor(
+      image.height(), rowsPerBand, [&](int firstRow, int lastRow) {
+        boxFilterVertical(rowMeans, leafletWindow.height, smoothedImage,
+                          firstRow, lastRow, kernelInstructionSet);
+      });
+  return smoothedImage;
+}
+
+// Calculates the conductance map in both float and double, whichever type the
+// images are stored in, and records how far apart they are.
+void ImageConverter::comparePrecision(const std::string &imageIdentifier,
+                                      const Image &tempImage) {
+  const Image &kMatrix = *kMatrices.at(imageIdentifier);
+  StageTimer timer(statistics.get(), RunStage::Conductance);
+  timer.addPixels(tempImage.size());
+  precisionComparisons[imageIdentifier] =
+      compareFloatWithDouble(getConductanceParameters(imageIdentifier),
+                             tempImage, kMatrix, kernelInstructionSet);
+}
+
+// Saves the comparisons of comparePrecision, one row per image.
+void ImageConverter::savePrecisionValidation() {
+  Path pathToFile =
+      baseSaveDirectory.generic_string() + "PrecisionValidation.csv";
+  if (!quiet) {
+    std::cout << "Saving file: " + pathToFile.string() + "\n";
+  }
+  std::ofstream outputFile(pathToFile.string());
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + pathToFile.string());
+  }
+  outputFile << "Image identifier,Pixels,Max absolute difference,Max "
+                "relative difference,Mean absolute difference"
+             << std::endl;
+  outputFile.precision(6);
+  for (auto &&comparison : precisionComparisons) {
+    outputFile << comparison.first << "," << comparison.second.comparedPixels
+               << "," << comparison.second.maximumAbsoluteDifference << ","
+               << comparison.second.maximumRelativeDifference << ","
+               << comparison.second.meanAbsoluteDifference << std::endl;
+  }
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + pathToFile.string());
+  }
+}
+
 // Calculates the conductance of a single pixel.
-double ImageConverter::calculateConductance(std::string imageIdentifier,
+double ImageConverter::calculateConductance(const std::string &imageIdentifier,
                                             int row, int column,
                                             double pixelTemp) {
-
-  // g = ( R + K(Ta - Tp) ) / ( Lw * (wp - wa) )
-  const double Lw = 40.68;
   double K = getKMatrixValue(imageIdentifier, row, column);
-  double Ta = getAirTemp(imageIdentifier, column);
-  double Wa = getWaValue(imageIdentifier);
-  double Wp = getWpValue(pixelTemp);
-
-  double numerator = rValue + K * (Ta - pixelTemp);
-  double denominator = Lw * (Wp - Wa);
-  return numerator / denominator;
+  return calculatePixelConductance(getConductanceParameters(imageIdentifier),
+                                   K, column, pixelTemp);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-double ImageConverter::getKMatrixValue(std::string imageIdentifier, int row,
-                                       int column) {
+double ImageConverter::getKMatrixValue(const std::string &imageIdentifier,
+                                       int row, int column) {
   auto it = kMatrices.find(imageIdentifier);
   if (it != kMatrices.end()) {
-    return it->second.at(row).at(column);
+    return it->second->at(row, column);
   } else {
     throw std::runtime_error("Temperature image " + imageIdentifier +
                              " does not have corresponding KMatrix.");
   }
 }
 
-// Gets the air temperature associated with a specific image number (from
-// data
-// file).
-double ImageConverter::getAirTemp(std::string imageIdentifier, double column) {
-  static double numberColumns =
-      (averageTemperatureImages.begin()->second)[0].size();
+// Gathers the values of the conductance equation that are the same for every
+// pixel of an image.
+ConductanceParameters
+ImageConverter::getConductanceParameters(const std::string &imageIdentifier) {
   auto it = airTemps.find(imageIdentifier);
-  if (it != airTemps.end()) {
-    auto airTempPair = it->second;
-
-    // airTempPair.first == airTemp at column 0
-    // airTempPair.second == airTemp at column (numberColumns) /
-    // (numberColumns)
-    // say temperature is linear between them
-
-    return airTempPair.second * (column / numberColumns) + airTempPair.first;
-    // return airTempPair.first;
-  } else {
+  if (it == airTemps.end()) {
     throw std::runtime_error("Temperature image " + imageIdentifier +
                              " does not have corresponding air temp value.");
   }
+
+  ConductanceParameters parameters;
+  parameters.rValue = rValue;
+  parameters.wa = getWaValue(imageIdentifier);
+  // airTemps.first == airTemp at column 0
+  // airTemps.second == airTemp at column (numberColumns) / (numberColumns)
+  // say temperature is linear between them
+  parameters.airTemps = it->second;
+  parameters.numberColumns = numberColumns;
+  parameters.saturationEvaluation = saturationEvaluation;
+  return parameters;
 }
 
 double ImageConverter::getAirTempGivenRatio(std::string imageId, double ratio) {
@@ -556,12 +1268,7 @@ double ImageConverter::getWaValue(std::string imageIdentifier) {
 
 // Gets the wp value of a pixel given its temperature.
 double ImageConverter::getWpValue(double pixelTemp) {
-  // w(p) = w0 * exp( -Tw / T(p))
-
-  const double w0 = 6.57959 * pow(10, 8);
-  const double Tw = 4982.85;
-
-  return w0 * exp(-Tw / (pixelTemp + 273.15));
+  return getSaturationValue(pixelTemp, saturationEvaluation);
 }
 
 double ImageConverter::getDeltaWValue(const std::string &imageIdentifier,
@@ -578,7 +1285,7 @@ double ImageConverter::getPixelTemp(std::string imageIdentifier,
 
   auto location = averageTemperatureImages.find(imageIdentifier);
   if (location != averageTemperatureImages.end()) {
-    return (location->second).at(coordinate.second).at(coordinate.first);
+    return (location->second).at(coordinate.second, coordinate.first);
   } else {
     throw std::runtime_error("Unexpected error saving leaflet data. "
                              "Conducatance number and temperature number do "
@@ -586,25 +1293,13 @@ double ImageConverter::getPixelTemp(std::string imageIdentifier,
   }
 }
 
-// Gets the average temperature of a 9 pixel leaflet centered at the
-// coordinate,
+// Gets the average temperature of the leaflet centered at the coordinate,
 // and with image number specified.
 double ImageConverter::getLeafletTemp(std::string imageIdentifier,
                                       const Coordinate &coordinate) {
   auto location = averageTemperatureImages.find(imageIdentifier);
   if (location != averageTemperatureImages.end()) {
-    Image tempImage = location->second;
-    double sum = 0.0;
-    sum += tempImage.at(coordinate.second - 1).at(coordinate.first - 1);
-    sum += tempImage.at(coordinate.second - 1).at(coordinate.first);
-    sum += tempImage.at(coordinate.second - 1).at(coordinate.first + 1);
-    sum += tempImage.at(coordinate.second).at(coordinate.first - 1);
-    sum += tempImage.at(coordinate.second).at(coordinate.first);
-    sum += tempImage.at(coordinate.second).at(coordinate.first + 1);
-    sum += tempImage.at(coordinate.second + 1).at(coordinate.first - 1);
-    sum += tempImage.at(coordinate.second + 1).at(coordinate.first);
-    sum += tempImage.at(coordinate.second + 1).at(coordinate.first + 1);
-    return sum / 9.0;
+    return getIntegralImage(location->second).mean(coordinate, leafletWindow);
   } else {
     throw std::runtime_error(
         "Unexpected error saving leaflet data. "
@@ -617,18 +1312,7 @@ double ImageConverter::getLeafletAverageK(const std::string &imageKey,
                                           const Coordinate &coordinate) {
   auto location = kMatrices.find(imageKey);
   if (location != kMatrices.end()) {
-    Image kMatrix = location->second;
-    double sum = 0.0;
-    sum += kMatrix.at(coordinate.second - 1).at(coordinate.first - 1);
-    sum += kMatrix.at(coordinate.second - 1).at(coordinate.first);
-    sum += kMatrix.at(coordinate.second - 1).at(coordinate.first + 1);
-    sum += kMatrix.at(coordinate.second).at(coordinate.first - 1);
-    sum += kMatrix.at(coordinate.second).at(coordinate.first);
-    sum += kMatrix.at(coordinate.second).at(coordinate.first + 1);
-    sum += kMatrix.at(coordinate.second + 1).at(coordinate.first - 1);
-    sum += kMatrix.at(coordinate.second + 1).at(coordinate.first);
-    sum += kMatrix.at(coordinate.second + 1).at(coordinate.first + 1);
-    return sum / 9.0;
+    return getIntegralImage(*location->second).mean(coordinate, leafletWindow);
   } else {
     throw std::runtime_error("Unexpected error saving leaflet data. "
                              "KMatrix identifier and temperature identifier do "
@@ -636,73 +1320,54 @@ double ImageConverter::getLeafletAverageK(const std::string &imageKey,
   }
 }
 
-// Gets the average conductance of a 9 pixel leaflet centered at the
-// coordinate,
+// Gets the summed-area table of an image, building it the first time it is
+// asked for. K matrices shared by several images share one table.
+const IntegralImage &ImageConverter::getIntegralImage(const Image &image) {
+  auto location = integralImages.find(&image);
+  if (location == integralImages.end()) {
+    location =
+        integralImages.insert(std::make_pair(&image, IntegralImage(image)))
+            .first;
+  }
+  return location->second;
+}
+
+// Gets the average conductance of the leaflet centered at the coordinate,
 // and with image number specified.
 double ImageConverter::getLeafletConductance(const std::string &imageId,
                                              double leafletTemperature,
                                              const Coordinate &coordinate) {
-  // g = ( R + K(Ta - Tp) ) / ( Lw * (wp - wa) )
-  const double Lw = 40.68;
   double kValue = getLeafletAverageK(imageId, coordinate);
-  double Wp = getWpValue(leafletTemperature);
-  double Wa = getWaValue(imageId);
-  double Ta = getAirTemp(imageId, coordinate.first);
-
-  double numerator = rValue + kValue * (Ta - leafletTemperature);
-  double denominator = Lw * (Wp - Wa);
-  return numerator / denominator;
-
-  return 0.0;
+  return calculatePixelConductance(getConductanceParameters(imageId), kValue,
+                                   coordinate.first, leafletTemperature);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-void ImageConverter::saveAverageTemperatureImages() {
-  std::ofstream outputFile;
-  boost::filesystem::path dir(baseSaveDirectory.generic_string() +
-                              "AverageTempImages/");
-  boost::filesystem::create_directory(dir);
-
-  std::string fileName = baseSaveDirectory.generic_string() +
-                         "AverageTempImages/" + date + "_AverageTemp_";
-
-  for (auto &&image : averageTemperatureImages) {
-    Path fullPathToFile = Path(fileName + image.first + ".csv");
-    saveImage(fullPathToFile, image.second);
-  }
-}
-
 void ImageConverter::saveImage(const Path &fileName, const Image &image) {
-  std::ofstream outputFile;
-  outputFile.open(fileName.string());
-
-  if (outputFile.is_open()) {
-    std::cout << "Saving file: " << fileName << std::endl;
-    for (auto &&row : image) {
-      for (auto &&entry : row) {
-        outputFile << entry << ",";
-      }
-      outputFile << std::endl;
-    }
-    outputFile.close();
-  } else {
-    throw std::runtime_error("ERROR OPENING FILE: " + fileName.string());
-    // std::cout << "ERROR OPENING FILE: " << fileName << std::endl;
+  if (!quiet) {
+    std::cout << "Saving file: \"" + fileName.string() + "\"\n";
+  }
+  StageTimer timer(statistics.get(), RunStage::Save);
+  imageWriter.save(fileName, image);
+  if (timer.enabled()) {
+    timer.addBytesWritten(boost::filesystem::file_size(fileName));
+    timer.addPixels(image.size());
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /* FUNCTIONS DEALING WITH SAVING PIXEL DATA TO FILES */
 
-// Gets pixels user would like to save data for, gathers and saves that data.
-void ImageConverter::summarizeSelectedPixels() {
+// Gets pixels user would like to save data for. Asked before the images are
+// loaded, so that the average images are only kept when they are needed.
+std::vector<std::string> ImageConverter::askWhichPixelsToSummarize() {
   std::cout << "Would you like to pull data about particular leaflets? [y/n]"
             << std::endl;
   bool answer = getYesNoResponseFromUser();
   if (answer) {
-    std::vector<std::string> coordinatesToAnalyze = getPixelChoicesFromUser();
-    createSelectedPixelsFile(coordinatesToAnalyze);
+    return getPixelChoicesFromUser();
   }
+  return std::vector<std::string>();
 }
 
 /* Gets a vector of excel coordinates that the user wants to get leaflet data
@@ -729,7 +1394,10 @@ void ImageConverter::createSelectedPixelsFile(
   std::ofstream outputFile;
   Path pathToFile = baseSaveDirectory.generic_string() + "PixelAnalysis.csv";
   outputFile.open(pathToFile.string());
-  std::cout << "Saving file: " << pathToFile.string() << std::endl;
+  if (!quiet) {
+    std::cout << "Saving file: " + pathToFile.string() + "\n";
+  }
+  StageTimer timer(statistics.get(), RunStage::PixelSummary);
   if (outputFile.is_open()) {
     for (auto &&excelCoordinate : coordinates) {
       outputFile << "Excel Coordinate:," << excelCoordinate << std::endl;
@@ -738,6 +1406,8 @@ void ImageConverter::createSelectedPixelsFile(
       printParticularPixelData(outputFile, coordinate);
       outputFile << std::endl;
     }
+    timer.addBytesWritten(outputFile.tellp());
+    timer.addPixels(coordinates.size() * averageTemperatureImages.size());
   }
 }
 
@@ -795,6 +1465,56 @@ void ImageConverter::printParticularPixelData(std::ofstream &outputFile,
   }
 }
 
+// Appends a row for each queried pixel of the image to the pixel table. The
+// values are those of PixelAnalysis.csv, but everything that is the same for
+// every pixel of the image is looked up once.
+void ImageConverter::appendPixelTableRows(const std::string &imageIdentifier,
+                                          const Image &tempImage,
+                                          std::string &table) {
+  auto it = kMatrices.find(imageIdentifier);
+  if (it == kMatrices.end()) {
+    throw std::runtime_error("Temperature image " + imageIdentifier +
+                             " does not have corresponding KMatrix.");
+  }
+  const Image &kMatrix = *it->second;
+  const ConductanceParameters parameters =
+      getConductanceParameters(imageIdentifier);
+  const IntegralImage temperatureSums(tempImage);
+  const IntegralImage &kMatrixSums = getIntegralImage(kMatrix);
+
+  auto appendValue = [this, &table](double value) {
+    table.push_back(',');
+    imageWriter.format(value, table);
+  };
+  for (auto &&query : pixelQueries) {
+    int row = query.coordinate.second;
+    int column = query.coordinate.first;
+    if (row < 0 || row >= tempImage.height() || column < 0 ||
+        column >= tempImage.width()) {
+      throw std::runtime_error("Pixel " + query.excelCoordinate +
+                               " is outside of the temperature images.");
+    }
+    double pixelTemp = tempImage(row, column);
+    double leafletTemp = temperatureSums.mean(query.coordinate, leafletWindow);
+    double leafletK = kMatrixSums.mean(query.coordinate, leafletWindow);
+
+    table.append(imageIdentifier);
+    table.push_back(',');
+    table.append(query.excelCoordinate);
+    table.append("," + std::to_string(column) + "," + std::to_string(row));
+    appendValue(parameters.wa);
+    appendValue(pixelTemp);
+    appendValue(getWpValue(pixelTemp) - parameters.wa);
+    appendValue(calculatePixelConductance(
+        parameters, kMatrix.at(row, column), column, pixelTemp));
+    appendValue(leafletTemp);
+    appendValue(getWpValue(leafletTemp) - parameters.wa);
+    appendValue(
+        calculatePixelConductance(parameters, leafletK, column, leafletTemp));
+    table.push_back('\n');
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Create K Matrix */
 
@@ -803,9 +1523,10 @@ void ImageConverter::iterateThroughKMatrixDirectoriesAndCreate() {
 
   for (boost::filesystem::directory_iterator itr(kMatrixDirectory);
        itr != endItr; ++itr) {
-    if (boost::filesystem::is_directory(itr->path())) {
+    if (boost::filesystem::is_directory(itr->path()) &&
+        !isHiddenEntry(itr->path())) {
       if (askIfKMatrixShouldBeCreated(itr->path())) {
-        getKMatrixDirectoryInputs();
+        getKMatrixDirectoryInputs(itr->path().stem().generic_string());
         createKMatrix(itr->path());
       }
     }
@@ -818,7 +1539,10 @@ bool ImageConverter::askIfKMatrixShouldBeCreated(const Path &path) {
   return getYesNoResponseFromUser();
 }
 
-void ImageConverter::getKMatrixDirectoryInputs() {
+// Asks for the R value and thermocouple temperatures of a calibration
+// directory. The air temperatures are kept under the name of the directory,
+// so each K matrix uses its own.
+void ImageConverter::getKMatrixDirectoryInputs(const std::string &kMatrixId) {
   getRValueFromUser();
 
   double upperBeforeThermocouple =
@@ -828,11 +1552,9 @@ void ImageConverter::getKMatrixDirectoryInputs() {
       getTemperatureOfThermocouple("'lower before'");
   double lowerAfterThermocouple = getTemperatureOfThermocouple("'lower after'");
 
-  std::pair<double, double> airTemp;
-  airTemp.first = (upperBeforeThermocouple + lowerBeforeThermocouple) / 2.0;
-  airTemp.second = (upperAfterThermocouple + lowerAfterThermocouple) / 2.0;
-
-  airTemps.insert(std::make_pair("all", airTemp));
+  airTemps[kMatrixId] =
+      loadAirTemperatures(upperBeforeThermocouple, upperAfterThermocouple,
+                          lowerBeforeThermocouple, lowerAfterThermocouple);
 }
 
 double ImageConverter::getTemperatureOfThermocouple(const std::string &name) {
@@ -845,35 +1567,60 @@ double ImageConverter::getTemperatureOfThermocouple(const std::string &name) {
 
 void ImageConverter::createKMatrix(const Path &directory) {
   Image tempImage = loadAndAverageAllFilesInDirectory(directory);
-  Image kMatrix;
-  for (auto &&row : tempImage) {
-    std::vector<double> kMatrixRow;
-    for (int column = 0; column < row.size(); ++column) {
-      kMatrixRow.push_back(getPixelKValue(row[column], column / row.size()));
+  saveImage(getKMatrixFileName(directory),
+            calculateKMatrix(directory.stem().generic_string(), rValue,
+                             tempImage));
+}
+
+Image ImageConverter::calculateKMatrix(const std::string &kMatrixId,
+                                       int kMatrixRValue,
+                                       const Image &tempImage) {
+  StageTimer timer(statistics.get(), RunStage::Conductance);
+  timer.addPixels(tempImage.size());
+  Image kMatrix(tempImage.width(), tempImage.height());
+  for (int row = 0; row < tempImage.height(); ++row) {
+    const Scalar *temperatures = tempImage.rowData(row);
+    Scalar *kValues = kMatrix.rowData(row);
+    for (int column = 0; column < tempImage.width(); ++column) {
+      kValues[column] = static_cast<Scalar>(
+          getPixelKValue(kMatrixId, kMatrixRValue, temperatures[column],
+                         column / tempImage.width()));
     }
-    kMatrix.push_back(kMatrixRow);
   }
-  std::string fullPathName = kMatrixDirectory.generic_string() + "KMatrix_" +
-                             directory.stem().generic_string() + ".csv";
-  saveImage(Path(fullPathName), kMatrix);
+  return kMatrix;
 }
 
-Image ImageConverter::loadAndAverageAllFilesInDirectory(const Path &dir) {
+Path ImageConverter::getKMatrixFileName(const Path &directory) {
+  return Path(kMatrixDirectory.generic_string() + "KMatrix_" +
+              directory.stem().generic_string() + imageWriter.extension());
+}
+
+std::vector<Path> ImageConverter::findFilesInDirectory(const Path &dir) {
+  StageTimer timer(statistics.get(), RunStage::DirectoryScan);
   boost::filesystem::directory_iterator endItr;
-  std::vector<Image> imagesInDirectory;
+  std::vector<Path> imagesInDirectory;
 
   for (boost::filesystem::directory_iterator itr(dir); itr != endItr; ++itr) {
-    if (is_regular_file(itr->path()) &&
-        itr->path().filename().string() != ".DS_Store") {
-      imagesInDirectory.push_back(loadImageFromFile(itr->path()));
+    if (is_regular_file(itr->path()) && !isHiddenEntry(itr->path())) {
+      imagesInDirectory.push_back(itr->path());
     }
   }
-  return averageImages(imagesInDirectory);
+  if (imagesInDirectory.empty()) {
+    throw std::runtime_error("Error! There were no images to load that "
+                             "match the specifier given.");
+  }
+  std::sort(imagesInDirectory.begin(), imagesInDirectory.end());
+  return imagesInDirectory;
+}
+
+Image ImageConverter::loadAndAverageAllFilesInDirectory(const Path &dir) {
+  return loadAndAverageImageGroups({findFilesInDirectory(dir)}).front();
 }
 
-double ImageConverter::getPixelKValue(double pixelTemp,
+double ImageConverter::getPixelKValue(const std::string &kMatrixId,
+                                      int kMatrixRValue, double pixelTemp,
                                       double ratioOfColumnToNumColums) {
   // K(p) = R / (T(p) - T_air)
-  double T_air = getAirTempGivenRatio("all", ratioOfColumnToNumColums);
-  return rValue / (pixelTemp - T_air);
+  double T_air = getAirTempGivenRatio(kMatrixId, ratioOfColumnToNumColums);
+  return kMatrixRValue / (pixelTemp - T_air);
 }
@@ -1,20 +1,144 @@
 #ifndef IMAGE_CONVERTER
 #define IMAGE_CONVERTER
 
+#include "ConductanceKernel.hpp"
+#include "FrameReader.hpp"
+#include "Image.hpp"
+#include "ImageWriter.hpp"
+#include "InputManifest.hpp"
+#include "IntegralImage.hpp"
+#include "KMatrixStore.hpp"
+#include "RunStatistics.hpp"
+#include "ThreadPool.hpp"
 #include <boost/filesystem.hpp>
+#include <functional>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
 using Path = boost::filesystem::path;
-using Image = std::vector<std::vector<double>>;
 using ImageMap = std::map<std::string, Image>;
 using ImagePair = std::pair<std::string, Image>;
-using Coordinate = std::pair<int, int>;
+
+// A pixel of the bulk pixel query, and the Excel coordinate it is reported
+// under.
+struct PixelQuery {
+  std::string excelCoordinate;
+  Coordinate coordinate;
+};
+
+// Settings chosen when the program is launched rather than through the
+// interactive prompts.
+struct ConverterOptions {
+  ConverterOptions()
+      : workerCount(0), useFrameCache(true),
+        kernelInstructionSet(bestKernelInstructionSet()),
+        saturationEvaluation(SaturationEvaluation::Exact), outputPrecision(0),
+        outputFormat(ImageFormat::Csv), backgroundWrites(true),
+        packMapsIntoArchive(false), validatePrecision(false),
+        createLeafletConductanceMaps(false), buildTimeSeriesStore(false),
+        quiet(false), recomputeChangedOnly(false),
+        skipImagesWithoutFrames(false) {}
+
+  // Number of threads used to parse frames. 0 uses one per hardware thread.
+  unsigned workerCount;
+  bool useFrameCache;
+  KernelInstructionSet kernelInstructionSet;
+  SaturationEvaluation saturationEvaluation;
+  // Significant digits of saved images. 0 writes every value exactly.
+  int outputPrecision;
+  // Format of saved conductance maps, average temperature images and
+  // K matrices.
+  ImageFormat outputFormat;
+  // Whether conductance maps are saved on their own thread while the next
+  // map is calculated.
+  bool backgroundWrites;
+  // Whether the average temperature images and conductance maps of a date
+  // are packed into one map archive instead of a file each. Maps are
+  // archived as float32 if the output format is NpyFloat32.
+  bool packMapsIntoArchive;
+  // Whether every conductance map is also calculated in float and double,
+  // and the differences saved to PrecisionValidation.csv.
+  bool validatePrecision;
+  // The pixels averaged around each selected pixel for its leaflet values.
+  LeafletWindow leafletWindow;
+  // Whether a map of the leaflet conductance around every pixel is saved
+  // along with each conductance map.
+  bool createLeafletConductanceMaps;
+  // Pixels whose values are saved to PixelTable.csv for every image of a
+  // date, as one row per image and pixel.
+  std::vector<PixelQuery> pixelQueries;
+  // Whether the average temperature and conductance of every pixel across
+  // the images of a date are saved pixel-major to a time series store.
+  bool buildTimeSeriesStore;
+  // Whether the line printed for every file loaded or saved is left out.
+  bool quiet;
+  // Where the time, bytes and pixels of each stage are added up. Nothing is
+  // measured when there are no statistics.
+  std::shared_ptr<RunStatistics> statistics;
+  // Whether the images of a date whose inputs match the input manifest of
+  // the last run, and whose maps still exist, are left as they are rather
+  // than recomputed.
+  bool recomputeChangedOnly;
+  // Whether program data rows whose frames have not arrived yet are left
+  // for a later run, rather than failing the run.
+  bool skipImagesWithoutFrames;
+};
+
+// One conductance map run of the batch mode: the answers to the questions the
+// interactive program asks.
+struct ConductanceJob {
+  std::string date;
+  int rValue;
+  CropWindow cropWindow;
+  // Excel coordinates of the pixels to summarize. PixelAnalysis.csv is only
+  // written when there are some.
+  std::vector<std::string> pixelCoordinates;
+};
+
+// One K matrix of the batch K matrix mode: a calibration directory and the
+// answers to the questions the interactive program asks about it.
+struct KMatrixJob {
+  // Relative directories are inside the KMatrix directory.
+  Path directory;
+  int rValue;
+  double upperBeforeThermocouple;
+  double upperAfterThermocouple;
+  double lowerBeforeThermocouple;
+  double lowerAfterThermocouple;
+  CropWindow cropWindow;
+};
 
 class ImageConverter {
 public:
-  ImageConverter(const Path &);
+  // Asks the user which program to run and runs it.
+  ImageConverter(const Path &,
+                 const ConverterOptions &options = ConverterOptions());
+
+  // Creates the conductance maps of a single job without asking anything.
+  // The thread pool and the K matrix store can be shared between converters;
+  // the store must only be shared by jobs with the same crop window.
+  ImageConverter(const Path &, const ConductanceJob &,
+                 const ConverterOptions &, std::shared_ptr<ThreadPool>,
+                 std::shared_ptr<KMatrixStore>);
+
+  // Creates the K matrices of every job without asking anything. The frames
+  // of every directory are parsed together, so the whole pool is busy
+  // however few frames each directory has.
+  ImageConverter(const Path &, const std::vector<KMatrixJob> &,
+                 const ConverterOptions &, std::shared_ptr<ThreadPool>);
+
+  // Convert from Excel coordinates to standard
+  static Coordinate convertExcelNumberToStandard(const std::string &);
+  static std::string convertStandardToExcelNumber(const Coordinate &);
+
+  // Reads a bulk pixel query file. Each line holds either Excel coordinates
+  // separated by spaces or commas, or a single standard coordinate written
+  // as "column,row" or "column row". Empty lines and lines starting with '#'
+  // are skipped.
+  static std::vector<PixelQuery> loadPixelQueries(const Path &);
 
 private:
   std::string date;
@@ -27,14 +151,65 @@ private:
   Path kMatrixDirectory;
 
   // Coordinates needed to crop raw temperature images to correct window size
-  Coordinate topLeftWindowCoordinate;
-  Coordinate bottomRightWindowCoordinate;
+  CropWindow cropWindow;
+
+  // Whether parsed frames are read from and saved to the binary frame cache.
+  bool useFrameCache;
+
+  // Workers used to parse frames in parallel.
+  std::shared_ptr<ThreadPool> threadPool;
+
+  // The temperature image identifier and K matrix identifier of each row of
+  // the program data file, in the order they appear.
+  std::vector<std::pair<std::string, std::string>> programDataRows;
+
+  // Instruction set used to calculate conductance images, and how they
+  // evaluate wp.
+  KernelInstructionSet kernelInstructionSet;
+  SaturationEvaluation saturationEvaluation;
+
+  // Formats saved images, and whether they are saved in the background.
+  ImageWriter imageWriter;
+  bool backgroundWrites;
+  bool packMapsIntoArchive;
+
+  // The float against double comparison of each conductance map, by image
+  // identifier. Only filled in when the precision is validated.
+  bool validatePrecision;
+  std::map<std::string, PrecisionComparison> precisionComparisons;
+
+  bool createLeafletConductanceMaps;
+  std::vector<PixelQuery> pixelQueries;
+  bool buildTimeSeriesStore;
+
+  bool quiet;
+  std::shared_ptr<RunStatistics> statistics;
+  bool recomputeChangedOnly;
+  bool skipImagesWithoutFrames;
+  // The number of frame groups being loaded that are K matrices, which come
+  // before the temperature images. Their frames are counted as K matrix
+  // loading rather than parsing and averaging.
+  size_t kMatrixGroupCount;
+
+  // Every K matrix loaded by the program, keyed by K matrix identifier.
+  std::shared_ptr<KMatrixStore> kMatrixStore;
 
   // Maps of data needed in program.
   // The key of the map is the image identifier
-  ImageMap kMatrices;
+  std::map<std::string, SharedImage> kMatrices;
+  // Only kept when the selected pixels are summarized.
   ImageMap averageTemperatureImages;
-  ImageMap conductanceMaps;
+
+  // Leaflet values are means over leafletWindow, read from the summed-area
+  // table of each average temperature image and K matrix.
+  LeafletWindow leafletWindow;
+  std::map<const Image *, IntegralImage> integralImages;
+  // Each K matrix box filtered over leafletWindow, for the leaflet
+  // conductance maps.
+  std::map<const Image *, Image> smoothedKMatrices;
+
+  // The width of the first average temperature image, by identifier.
+  double numberColumns;
 
   // The first in the pair is the average air temperature on the left side of
   // the chamber, and the second in the pair is on the right side of the
@@ -45,10 +220,13 @@ private:
   // Main Program Execution
   void runKMatrixCreationProgram(const Path &);
   void runConductanceMapCreationProgram(const Path &);
+  void runConductanceMapJob(const Path &, const ConductanceJob &);
+  void runKMatrixJobs(const Path &, const std::vector<KMatrixJob> &);
 
   // Initialize variables particular to each program execution type.
   void initializeVariablesForKMatrixProgram(const Path &);
   void initializeVariablesForConductanceMapProgram(const Path &);
+  void initializeConductanceMapPaths(const Path &);
 
   // Basic user input communication.
   int getProgramExecutionType();
@@ -67,34 +245,57 @@ private:
   Path getCorrectPathFromUser();
   void confirmCropImageCoordinatesAreCorrect();
 
+  // The frames of every image loaded to create the conductance maps.
+  struct ProgramDataImages {
+    std::vector<std::string> temperatureIds;
+    // The K matrix identifier of each temperature image.
+    std::vector<std::string> kMatrixIds;
+    // The K matrices that are not in the store yet.
+    std::vector<std::string> kMatrixIdsToLoad;
+    // The frames of each K matrix to load, followed by the frames of each
+    // temperature image.
+    std::vector<std::vector<Path>> frameGroups;
+    // The files of every K matrix the images use, whether or not it is in
+    // the store already.
+    std::map<std::string, std::vector<Path>> kMatrixFiles;
+  };
+
   // Load necessary data
   void loadAllConductanceProgramData();
   void parseInputFileLine(std::istringstream &);
-  Image loadImageFromFile(const Path &);
-  std::vector<double> parseImageFileRow(const std::string &);
-  void loadKMatrixWithIdentifier(const std::string &tempId,
-                                 const std::string &kMatrixId);
-  void loadTemperatureImagesWithIdentifier(const std::string &tempId);
-  Image getAndAverageImagesWithIdentifier(const std::string &, const Path &);
-  Image averageImages(const std::vector<Image> &);
+  ProgramDataImages findProgramDataImages();
+  Image loadImageFromFile(const Path &, RunStage stage = RunStage::Parse);
+  std::vector<Image>
+  loadAndAverageImageGroups(const std::vector<std::vector<Path>> &);
+  void loadAndAverageImageGroups(
+      const std::vector<std::vector<Path>> &,
+      const std::function<bool(size_t group, Image average)> &);
   std::pair<double, double> loadAirTemperatures(double flThermo,
                                                 double blThermo,
                                                 double frThermo,
                                                 double brThermo);
 
   // Convert from Excel coordinates to standard
-  Coordinate convertExcelNumberToStandard(const std::string &);
-  int convertExcelXCoordinate(const std::string &);
-  int getCharValue(char);
+  static int convertExcelXCoordinate(const std::string &);
+  static int getCharValue(char);
 
   // Create conductance maps
-  void createConductanceMaps();
-  Image createConductanceImage(std::string, const Image &);
-  double calculateConductance(std::string, int, int, double);
+  void createConductanceMaps(bool keepAverageTemperatureImages);
+  void linkKMatrices(const ProgramDataImages &);
+  InputManifest fingerprintInputs(const ProgramDataImages &);
+  void removeImages(ProgramDataImages &, const std::set<std::string> &);
+  Image createConductanceImage(const std::string &, const Image &);
+  Image createLeafletConductanceImage(const std::string &, const Image &);
+  Image calculateConductanceInBands(const ConductanceParameters &,
+                                    const Image &, const Image &);
+  Image smoothImage(const Image &);
+  void comparePrecision(const std::string &, const Image &);
+  void savePrecisionValidation();
+  double calculateConductance(const std::string &, int, int, double);
 
   // Get data for conductance equations
-  double getKMatrixValue(std::string, int, int);
-  double getAirTemp(std::string, double);
+  double getKMatrixValue(const std::string &, int, int);
+  ConductanceParameters getConductanceParameters(const std::string &);
   double getAirTempGivenRatio(std::string, double);
   double getWaValue(std::string);
   double getWpValue(double);
@@ -103,26 +304,33 @@ private:
   double getLeafletAverageK(const std::string &, const Coordinate &);
   double getLeafletTemp(std::string, const Coordinate &);
   double getLeafletConductance(const std::string &, double, const Coordinate &);
+  const IntegralImage &getIntegralImage(const Image &);
 
   // Save data to files
-  void saveAverageTemperatureImages();
   void saveImage(const Path &, const Image &);
 
   // Create pixel summary file
-  void summarizeSelectedPixels();
+  std::vector<std::string> askWhichPixelsToSummarize();
   std::vector<std::string> getPixelChoicesFromUser();
   void createSelectedPixelsFile(const std::vector<std::string> &);
   void writeCoordinateHeader(std::ofstream &, const Coordinate &);
   void printParticularPixelData(std::ofstream &, const Coordinate &);
 
+  // Create bulk pixel table
+  void appendPixelTableRows(const std::string &, const Image &,
+                            std::string &);
+
   // Create K Matrix
   void iterateThroughKMatrixDirectoriesAndCreate();
   bool askIfKMatrixShouldBeCreated(const Path &);
-  void getKMatrixDirectoryInputs();
+  void getKMatrixDirectoryInputs(const std::string &);
   double getTemperatureOfThermocouple(const std::string &);
   void createKMatrix(const Path &);
+  Image calculateKMatrix(const std::string &, int, const Image &);
+  Path getKMatrixFileName(const Path &);
+  std::vector<Path> findFilesInDirectory(const Path &);
   Image loadAndAverageAllFilesInDirectory(const Path &);
-  double getPixelKValue(double, double);
+  double getPixelKValue(const std::string &, int, double, double);
 };
 
 #endif
@@ -0,0 +1,161 @@
+#include "ImageWriter.hpp"
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Large enough that a file takes only a few writes.
+const size_t bufferSize = 1 << 20;
+
+// Longer than any double printed by to_chars, in either format.
+const size_t maximumValueLength = 32;
+
+template <typename T>
+void formatValue(T value, int significantDigits, std::string &buffer) {
+  char text[maximumValueLength];
+  std::to_chars_result result;
+  if (significantDigits == 0) {
+    result = std::to_chars(text, text + sizeof(text), value);
+  } else {
+    result = std::to_chars(text, text + sizeof(text), value,
+                           std::chars_format::general, significantDigits);
+  }
+  buffer.append(text, result.ptr);
+}
+
+} // namespace
+
+ImageFormat parseImageFormat(const std::string &name) {
+  if (name == "csv") {
+    return ImageFormat::Csv;
+  } else if (name == "npy") {
+    return ImageFormat::Npy;
+  } else if (name == "npy32") {
+    return ImageFormat::NpyFloat32;
+  }
+  throw std::runtime_error("Unknown image format: " + name);
+}
+
+ImageWriter::ImageWriter(int precision, ImageFormat imageFormat)
+    : significantDigits(precision), imageFormat(imageFormat) {
+  if (precision < 0 || precision > 17) {
+    throw std::runtime_error("The output precision must be between 0 and 17 "
+                             "significant digits.");
+  }
+}
+
+void ImageWriter::format(double value, std::string &buffer) const {
+  formatValue(value, significantDigits, buffer);
+}
+
+void ImageWriter::format(float value, std::string &buffer) const {
+  formatValue(value, significantDigits, buffer);
+}
+
+std::string ImageWriter::extension() const {
+  return imageFormat == ImageFormat::Csv ? ".csv" : ".npy";
+}
+
+void ImageWriter::save(const boost::filesystem::path &fileName,
+                       const Image &image) const {
+  switch (imageFormat) {
+  case ImageFormat::Npy:
+    writeNpy(fileName, image, NpyElementType::Float64);
+    return;
+  case ImageFormat::NpyFloat32:
+    writeNpy(fileName, image, NpyElementType::Float32);
+    return;
+  default:
+    saveCsv(fileName, image);
+  }
+}
+
+void ImageWriter::saveCsv(const boost::filesystem::path &fileName,
+                          const Image &image) const {
+  std::ofstream outputFile(fileName.string(), std::ios::binary);
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + fileName.string());
+  }
+
+  std::string buffer;
+  buffer.reserve(bufferSize + maximumValueLength);
+  for (int row = 0; row < image.height(); ++row) {
+    bool firstValue = true;
+    for (auto &&entry : image.row(row)) {
+      if (!firstValue) {
+        buffer.push_back(',');
+      }
+      firstValue = false;
+      format(entry, buffer);
+      if (buffer.size() >= bufferSize) {
+        outputFile.write(buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    }
+    buffer.push_back('\n');
+  }
+  outputFile.write(buffer.data(), buffer.size());
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + fileName.string());
+  }
+}
+
+AsyncImageWriter::AsyncImageWriter(SaveFunction save, bool background)
+    : saveFunction(std::move(save)), queue(4) {
+  if (background) {
+    ioThread = std::thread(&AsyncImageWriter::run, this);
+  }
+}
+
+AsyncImageWriter::~AsyncImageWriter() {
+  queue.close();
+  if (ioThread.joinable()) {
+    ioThread.join();
+  }
+}
+
+void AsyncImageWriter::save(const boost::filesystem::path &fileName,
+                            std::shared_ptr<const Image> image) {
+  if (!ioThread.joinable()) {
+    saveFunction(fileName, *image);
+    return;
+  }
+  // The queue is closed once a save fails.
+  if (!queue.push(std::make_pair(fileName, std::move(image)))) {
+    rethrowError();
+    throw std::runtime_error("Image saved after the writer was finished.");
+  }
+}
+
+void AsyncImageWriter::finish() {
+  queue.close();
+  if (ioThread.joinable()) {
+    ioThread.join();
+  }
+  rethrowError();
+}
+
+void AsyncImageWriter::run() {
+  QueuedImage image;
+  while (queue.pop(image)) {
+    try {
+      saveFunction(image.first, *image.second);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      firstError = std::current_exception();
+      queue.close();
+      return;
+    }
+    image.second.reset();
+  }
+}
+
+void AsyncImageWriter::rethrowError() {
+  std::lock_guard<std::mutex> lock(errorMutex);
+  if (firstError) {
+    std::rethrow_exception(firstError);
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef IMAGE_WRITER
+#define IMAGE_WRITER
+
+#include "BoundedQueue.hpp"
+#include "Image.hpp"
+#include "NpyFile.hpp"
+#include <boost/filesystem.hpp>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// The file format images are saved in. Npy and NpyFloat32 are NumPy .npy
+// files of float64 and float32 values.
+enum class ImageFormat { Csv, Npy, NpyFloat32 };
+
+ImageFormat parseImageFormat(const std::string &);
+
+// Writes images as CSV files, one image row per line with the values
+// separated by commas, or as .npy files. CSV rows are formatted into a large
+// buffer that is written out whenever it fills up, and the file is flushed
+// once, when it is closed.
+class ImageWriter {
+public:
+  // A precision of 0 writes the shortest text that reads back as exactly the
+  // same double. Otherwise values are rounded to that many significant
+  // digits, as printf's %g does. Only CSV files use the precision.
+  explicit ImageWriter(int precision = 0,
+                       ImageFormat imageFormat = ImageFormat::Csv);
+
+  int precision() const { return significantDigits; }
+  ImageFormat format() const { return imageFormat; }
+  // The extension of saved files, including the dot.
+  std::string extension() const;
+
+  // Throws if the file cannot be opened or written.
+  void save(const boost::filesystem::path &, const Image &) const;
+
+  // Appends the text of a single value to the buffer. Floats are printed
+  // with the digits of a float, so that they round-trip without noise.
+  void format(double value, std::string &buffer) const;
+  void format(float value, std::string &buffer) const;
+
+private:
+  int significantDigits;
+  ImageFormat imageFormat;
+
+  void saveCsv(const boost::filesystem::path &, const Image &) const;
+};
+
+// Hands images to a save function, either on the calling thread or on a
+// background I/O thread so that the caller does not wait for the disk. At
+// most a few images are queued for the background thread; after that save()
+// waits for it.
+class AsyncImageWriter {
+public:
+  using SaveFunction =
+      std::function<void(const boost::filesystem::path &, const Image &)>;
+
+  AsyncImageWriter(SaveFunction save, bool background);
+  // Waits for the queued images, ignoring errors. Call finish() to see them.
+  ~AsyncImageWriter();
+
+  AsyncImageWriter(const AsyncImageWriter &) = delete;
+  AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+
+  // Saves the image, or queues it. Throws the error of an earlier save if
+  // one failed.
+  void save(const boost::filesystem::path &,
+            std::shared_ptr<const Image> image);
+
+  // Waits until every queued image is saved, and throws the first error.
+  void finish();
+
+private:
+  using QueuedImage =
+      std::pair<boost::filesystem::path, std::shared_ptr<const Image>>;
+
+  SaveFunction saveFunction;
+  BoundedQueue<QueuedImage> queue;
+  std::thread ioThread;
+
+  std::mutex errorMutex;
+  std::exception_ptr firstError;
+
+  void run();
+  void rethrowError();
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "InputManifest.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+const char *manifestHeader =
+    "Image identifier,Frames,K matrix,Program data,Settings";
+
+} // namespace
+
+Fingerprint::Fingerprint() : hash(14695981039346656037ull) {}
+
+void Fingerprint::add(const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+}
+
+// The length is added too, so that "ab" + "c" differs from "a" + "bc".
+void Fingerprint::add(const std::string &text) {
+  addInteger(text.size());
+  add(text.data(), text.size());
+}
+
+void Fingerprint::addInteger(int64_t value) { add(&value, sizeof(value)); }
+
+void Fingerprint::addNumber(double value) { add(&value, sizeof(value)); }
+
+void Fingerprint::addFileStamp(const boost::filesystem::path &path) {
+  struct stat fileStatus;
+  if (stat(path.string().c_str(), &fileStatus) != 0) {
+    throw std::runtime_error("BAD INPUT FILE: " + path.string());
+  }
+#ifdef __APPLE__
+  const struct timespec &modified = fileStatus.st_mtimespec;
+#else
+  const struct timespec &modified = fileStatus.st_mtim;
+#endif
+  add(path.filename().string());
+  addInteger(fileStatus.st_size);
+  addInteger(static_cast<int64_t>(modified.tv_sec) * 1000000000 +
+             modified.tv_nsec);
+}
+
+std::string Fingerprint::hex() const {
+  char text[17];
+  std::snprintf(text, sizeof(text), "%016llx",
+                static_cast<unsigned long long>(hash));
+  return text;
+}
+
+bool operator==(const InputFingerprints &a, const InputFingerprints &b) {
+  return a.frames == b.frames && a.kMatrix == b.kMatrix &&
+         a.programData == b.programData && a.settings == b.settings;
+}
+
+bool operator!=(const InputFingerprints &a, const InputFingerprints &b) {
+  return !(a == b);
+}
+
+InputManifest loadInputManifest(const boost::filesystem::path &path) {
+  InputManifest manifest;
+  std::ifstream inputFile(path.string());
+  if (!inputFile.is_open()) {
+    return manifest;
+  }
+  std::string inputLine;
+  std::getline(inputFile, inputLine);
+  if (inputLine != manifestHeader) {
+    throw std::runtime_error("BAD INPUT FILE: " + path.string());
+  }
+  while (std::getline(inputFile, inputLine)) {
+    if (inputLine.empty()) {
+      continue;
+    }
+    std::vector<std::string> fields;
+    std::istringstream rowToParse(inputLine);
+    for (std::string field; std::getline(rowToParse, field, ',');) {
+      fields.push_back(field);
+    }
+    if (fields.size() != 5) {
+      throw std::runtime_error("BAD INPUT FILE: " + path.string());
+    }
+    manifest[fields[0]] = {fields[1], fields[2], fields[3], fields[4]};
+  }
+  return manifest;
+}
+
+void saveInputManifest(const boost::filesystem::path &path,
+                       const InputManifest &manifest) {
+  std::ofstream outputFile(path.string());
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + path.string());
+  }
+  outputFile << manifestHeader << "\n";
+  for (auto &&entry : manifest) {
+    outputFile << entry.first << "," << entry.second.frames << ","
+               << entry.second.kMatrix << "," << entry.second.programData
+               << "," << entry.second.settings << "\n";
+  }
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + path.string());
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef INPUT_MANIFEST
+#define INPUT_MANIFEST
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// A 64-bit FNV-1a hash of everything added to it.
+class Fingerprint {
+public:
+  Fingerprint();
+
+  void add(const void *data, size_t size);
+  void add(const std::string &);
+  void addInteger(int64_t);
+  void addNumber(double);
+  // Adds the name, size and modification time of the file, which change
+  // whenever it is edited or replaced, without reading it. Throws if the
+  // file does not exist.
+  void addFileStamp(const boost::filesystem::path &);
+
+  std::string hex() const;
+
+private:
+  uint64_t hash;
+};
+
+// The fingerprints of what the outputs of one image were created from.
+struct InputFingerprints {
+  // Its frames.
+  std::string frames;
+  // The files of its K matrix.
+  std::string kMatrix;
+  // Its row of the program data file.
+  std::string programData;
+  // The R value, crop window and output settings of the run.
+  std::string settings;
+};
+
+bool operator==(const InputFingerprints &, const InputFingerprints &);
+bool operator!=(const InputFingerprints &, const InputFingerprints &);
+
+using InputManifest = std::map<std::string, InputFingerprints>;
+
+// Reads a manifest saved by saveInputManifest. A manifest that does not exist
+// is empty.
+InputManifest loadInputManifest(const boost::filesystem::path &);
+
+// Saves the manifest as CSV, one row per image identifier:
+//
+//   Image identifier,Frames,K matrix,Program data,Settings
+void saveInputManifest(const boost::filesystem::path &, const InputManifest &);
+
+#endif
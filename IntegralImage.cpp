@@ -0,0 +1,104 @@
+#include "IntegralImage.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+LeafletWindow parseLeafletWindow(const std::string &text) {
+  int width = 0;
+  int height = 0;
+  char separator = 0;
+  char trailing = 0;
+  int fields = std::sscanf(text.c_str(), "%d%c%d%c", &width, &separator,
+                           &height, &trailing);
+  if (fields == 1) {
+    height = width;
+  } else if (fields != 3 || (separator != 'x' && separator != 'X')) {
+    throw std::runtime_error("Bad leaflet window: \"" + text +
+                             "\". Expected N or WxH.");
+  }
+  if (width < 1 || height < 1) {
+    throw std::runtime_error("The leaflet window must be at least 1x1.");
+  }
+  return LeafletWindow(width, height);
+}
+
+namespace {
+
+// Fills the summed-area table of valueOf(pixel) over the image.
+template <typename T, typename ValueOf>
+void fillSummedAreaTable(const Image &image, BasicImage<T> &table,
+                         ValueOf valueOf) {
+  for (int row = 0; row < image.height(); ++row) {
+    const Scalar *values = image.rowData(row);
+    const T *above = table.rowData(row);
+    T *current = table.rowData(row + 1);
+    T rowSum = 0;
+    for (int column = 0; column < image.width(); ++column) {
+      rowSum += valueOf(values[column]);
+      current[column + 1] = above[column + 1] + rowSum;
+    }
+  }
+}
+
+template <typename T>
+T rectangleSum(const BasicImage<T> &table, int firstRow, int firstColumn,
+               int lastRow, int lastColumn) {
+  return table(lastRow, lastColumn) - table(firstRow, lastColumn) -
+         table(lastRow, firstColumn) + table(firstRow, firstColumn);
+}
+
+} // namespace
+
+IntegralImage::IntegralImage(const Image &image)
+    : sums(image.width() + 1, image.height() + 1) {
+  bool allFinite = true;
+  fillSummedAreaTable(image, sums, [&allFinite](Scalar value) {
+    if (std::isfinite(value)) {
+      return static_cast<double>(value);
+    }
+    allFinite = false;
+    return 0.0;
+  });
+  if (!allFinite) {
+    nonFiniteCounts = BasicImage<int>(image.width() + 1, image.height() + 1);
+    fillSummedAreaTable(image, nonFiniteCounts, [](Scalar value) {
+      return std::isfinite(value) ? 0 : 1;
+    });
+  }
+}
+
+double IntegralImage::sum(int firstRow, int firstColumn, int lastRow,
+                          int lastColumn) const {
+  firstRow = std::max(firstRow, 0);
+  firstColumn = std::max(firstColumn, 0);
+  lastRow = std::min(lastRow, height());
+  lastColumn = std::min(lastColumn, width());
+  if (firstRow >= lastRow || firstColumn >= lastColumn) {
+    return 0.0;
+  }
+  if (!nonFiniteCounts.empty() &&
+      rectangleSum(nonFiniteCounts, firstRow, firstColumn, lastRow,
+                   lastColumn) > 0) {
+    return std::nan("");
+  }
+  return rectangleSum(sums, firstRow, firstColumn, lastRow, lastColumn);
+}
+
+double IntegralImage::mean(const Coordinate &coordinate,
+                           const LeafletWindow &window) const {
+  int row = coordinate.second;
+  int column = coordinate.first;
+  if (row < 0 || row >= height() || column < 0 || column >= width()) {
+    throw std::out_of_range("Pixel (" + std::to_string(row) + ", " +
+                            std::to_string(column) +
+                            ") is outside of the image.");
+  }
+
+  int firstRow = std::max(row - (window.height - 1) / 2, 0);
+  int firstColumn = std::max(column - (window.width - 1) / 2, 0);
+  int lastRow = std::min(row + window.height / 2 + 1, height());
+  int lastColumn = std::min(column + window.width / 2 + 1, width());
+  int pixelCount = (lastRow - firstRow) * (lastColumn - firstColumn);
+  return sum(firstRow, firstColumn, lastRow, lastColumn) / pixelCount;
+}
@@ -0,0 +1,53 @@
+#ifndef INTEGRAL_IMAGE
+#define INTEGRAL_IMAGE
+
+#include "Image.hpp"
+#include <string>
+
+// The rectangle of pixels averaged around a pixel to give its leaflet
+// values. The window is centred on the pixel; a window with an even width or
+// height reaches one pixel further right or down than left or up.
+struct LeafletWindow {
+  LeafletWindow(int width = 3, int height = 3) : width(width), height(height) {}
+
+  int width;
+  int height;
+};
+
+// Parses "N" as an N x N window and "WxH" as a W wide, H high window.
+LeafletWindow parseLeafletWindow(const std::string &);
+
+// Summed-area table of an image. Entry (r, c) holds the sum of every pixel
+// above and to the left of pixel (r, c), so the sum, and so the mean, of any
+// rectangle takes four lookups however large the rectangle is. The sums are
+// kept in double whatever type the image is stored in.
+//
+// Non-finite pixels, such as those of a K matrix where a calibration pixel
+// was at the air temperature, are left out of the sums and counted in a
+// second table instead, which is only built when the image has any. The sum
+// and mean of a rectangle that holds one is NaN, so a bad pixel only spoils
+// the windows it is in rather than every sum below and right of it.
+class IntegralImage {
+public:
+  explicit IntegralImage(const Image &);
+
+  int width() const { return sums.width() - 1; }
+  int height() const { return sums.height() - 1; }
+
+  // The sum of rows [firstRow, lastRow) and columns [firstColumn,
+  // lastColumn), after clamping both ranges to the image, or NaN if they hold
+  // a non-finite pixel.
+  double sum(int firstRow, int firstColumn, int lastRow, int lastColumn) const;
+
+  // The mean of the window centred on the pixel at (column, row). Parts of
+  // the window outside of the image are left out of the mean. Throws
+  // std::out_of_range if the pixel itself is outside of the image.
+  double mean(const Coordinate &, const LeafletWindow &) const;
+
+private:
+  BasicImage<double> sums;
+  // Empty when every pixel is finite.
+  BasicImage<int> nonFiniteCounts;
+};
+
+#endif
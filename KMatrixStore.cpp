@@ -0,0 +1,45 @@
+#include "KMatrixStore.hpp"
+#include <algorithm>
+
+bool KMatrixStore::contains(const std::string &kMatrixId) const {
+  std::lock_guard<std::mutex> lock(storeMutex);
+  return kMatrices.count(kMatrixId) != 0;
+}
+
+SharedImage KMatrixStore::find(const std::string &kMatrixId) const {
+  std::lock_guard<std::mutex> lock(storeMutex);
+  auto location = kMatrices.find(kMatrixId);
+  return location == kMatrices.end() ? SharedImage() : location->second;
+}
+
+SharedImage KMatrixStore::insert(const std::string &kMatrixId, Image kMatrix) {
+  std::lock_guard<std::mutex> lock(storeMutex);
+  auto location = kMatrices.find(kMatrixId);
+  if (location == kMatrices.end()) {
+    location =
+        kMatrices
+            .insert(std::make_pair(
+                kMatrixId, std::make_shared<const Image>(std::move(kMatrix))))
+            .first;
+  }
+  return location->second;
+}
+
+std::vector<std::string> KMatrixStore::missingIdentifiers(
+    const std::vector<std::string> &kMatrixIds) const {
+  std::lock_guard<std::mutex> lock(storeMutex);
+  std::vector<std::string> missing;
+  for (auto &&kMatrixId : kMatrixIds) {
+    if (!kMatrices.count(kMatrixId) &&
+        std::find(missing.begin(), missing.end(), kMatrixId) ==
+            missing.end()) {
+      missing.push_back(kMatrixId);
+    }
+  }
+  return missing;
+}
+
+size_t KMatrixStore::size() const {
+  std::lock_guard<std::mutex> lock(storeMutex);
+  return kMatrices.size();
+}
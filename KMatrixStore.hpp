@@ -0,0 +1,38 @@
+#ifndef K_MATRIX_STORE
+#define K_MATRIX_STORE
+
+#include "Image.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using SharedImage = std::shared_ptr<const Image>;
+
+// Holds each K matrix once, keyed by its K matrix identifier. Temperature
+// images that share a calibration share the same immutable matrix, so a date
+// with hundreds of images but three calibrations keeps three matrices.
+class KMatrixStore {
+public:
+  bool contains(const std::string &kMatrixId) const;
+
+  // Returns the stored matrix, or a null pointer if it hasn't been loaded.
+  SharedImage find(const std::string &kMatrixId) const;
+
+  // Stores the matrix unless one with the identifier is already stored, and
+  // returns the stored matrix.
+  SharedImage insert(const std::string &kMatrixId, Image kMatrix);
+
+  // The identifiers in the list that are not stored yet, without repeats.
+  std::vector<std::string>
+  missingIdentifiers(const std::vector<std::string> &kMatrixIds) const;
+
+  size_t size() const;
+
+private:
+  mutable std::mutex storeMutex;
+  std::map<std::string, SharedImage> kMatrices;
+};
+
+#endif
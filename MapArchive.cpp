@@ -0,0 +1,233 @@
+#include "MapArchive.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char archiveMagic[4] = {'T', '2', 'C', 'A'};
+const uint32_t archiveVersion = 1;
+const uint64_t mapAlignment = 64;
+
+struct ArchiveHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t indexOffset;
+  uint64_t mapCount;
+};
+
+struct ArchiveIndexEntry {
+  uint64_t offset;
+  int32_t width;
+  int32_t height;
+  uint32_t elementSize;
+  uint32_t nameLength;
+};
+
+// Reads elements of type T, which need not be aligned.
+template <typename T>
+void readElements(const char *source, int count, Scalar *destination) {
+  for (int i = 0; i < count; ++i) {
+    T value;
+    std::memcpy(&value, source + i * sizeof(T), sizeof(T));
+    destination[i] = static_cast<Scalar>(value);
+  }
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/* WRITER */
+
+MapArchiveWriter::MapArchiveWriter(const boost::filesystem::path &path,
+                                   int elementSize)
+    : archivePath(path), temporaryPath(path.string() + ".tmp"),
+      elementSize(elementSize), position(0) {
+  if (elementSize != 4 && elementSize != 8) {
+    throw std::runtime_error("Archived maps must be float32 or float64.");
+  }
+  outputFile.open(temporaryPath.string(), std::ios::binary);
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + temporaryPath.string());
+  }
+  // The index offset and map count are filled in by close().
+  ArchiveHeader header = {};
+  std::memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+  header.version = archiveVersion;
+  write(&header, sizeof(header));
+}
+
+MapArchiveWriter::~MapArchiveWriter() {
+  if (outputFile.is_open()) {
+    outputFile.close();
+    boost::system::error_code ignored;
+    boost::filesystem::remove(temporaryPath, ignored);
+  }
+}
+
+void MapArchiveWriter::add(const std::string &name, const Image &image) {
+  const char padding[mapAlignment] = {};
+  write(padding, (mapAlignment - position % mapAlignment) % mapAlignment);
+
+  index.push_back({name, position, image.width(), image.height()});
+  std::vector<float> floatRow;
+  std::vector<double> doubleRow;
+  for (int row = 0; row < image.height(); ++row) {
+    const Scalar *values = image.rowData(row);
+    if (elementSize == sizeof(Scalar)) {
+      write(values, image.width() * sizeof(Scalar));
+    } else if (elementSize == sizeof(float)) {
+      floatRow.assign(values, values + image.width());
+      write(floatRow.data(), floatRow.size() * sizeof(float));
+    } else {
+      doubleRow.assign(values, values + image.width());
+      write(doubleRow.data(), doubleRow.size() * sizeof(double));
+    }
+  }
+  checkWritten();
+}
+
+void MapArchiveWriter::close() {
+  ArchiveHeader header = {};
+  std::memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+  header.version = archiveVersion;
+  header.indexOffset = position;
+  header.mapCount = index.size();
+
+  for (auto &&map : index) {
+    ArchiveIndexEntry entry = {map.offset, map.width, map.height, elementSize,
+                               static_cast<uint32_t>(map.name.size())};
+    write(&entry, sizeof(entry));
+    write(map.name.data(), map.name.size());
+  }
+  outputFile.seekp(0);
+  outputFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + temporaryPath.string());
+  }
+  boost::filesystem::rename(temporaryPath, archivePath);
+}
+
+void MapArchiveWriter::write(const void *data, size_t size) {
+  outputFile.write(static_cast<const char *>(data), size);
+  position += size;
+}
+
+void MapArchiveWriter::checkWritten() {
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + temporaryPath.string());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* READER */
+
+MapArchive::MapArchive(const boost::filesystem::path &path)
+    : archivePath(path), file(new MappedFile(path)) {
+  auto badArchive = [&path](const std::string &problem) {
+    return std::runtime_error(path.string() + ": " + problem);
+  };
+
+  ArchiveHeader header;
+  if (file->size() < sizeof(header)) {
+    throw badArchive("Not a map archive.");
+  }
+  std::memcpy(&header, file->begin(), sizeof(header));
+  if (std::memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) != 0 ||
+      header.version != archiveVersion) {
+    throw badArchive("Not a map archive.");
+  }
+
+  uint64_t position = header.indexOffset;
+  for (uint64_t i = 0; i < header.mapCount; ++i) {
+    ArchiveIndexEntry indexEntry;
+    if (position + sizeof(indexEntry) > file->size()) {
+      throw badArchive("The archive index is truncated.");
+    }
+    std::memcpy(&indexEntry, file->begin() + position, sizeof(indexEntry));
+    position += sizeof(indexEntry);
+    if (position + indexEntry.nameLength > file->size()) {
+      throw badArchive("The archive index is truncated.");
+    }
+
+    Entry entry;
+    entry.name.assign(file->begin() + position, indexEntry.nameLength);
+    position += indexEntry.nameLength;
+    entry.width = indexEntry.width;
+    entry.height = indexEntry.height;
+    entry.elementSize = indexEntry.elementSize;
+    entry.offset = indexEntry.offset;
+    if ((entry.elementSize != 4 && entry.elementSize != 8) ||
+        entry.width < 0 || entry.height < 0 ||
+        entry.offset + uint64_t(entry.width) * entry.height *
+                               entry.elementSize >
+            header.indexOffset) {
+      throw badArchive("The archive index is corrupt.");
+    }
+    index.push_back(entry);
+  }
+}
+
+const MapArchive::Entry *MapArchive::find(const std::string &name) const {
+  for (auto &&entry : index) {
+    if (entry.name == name) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const MapArchive::Entry &MapArchive::entry(const std::string &name) const {
+  const Entry *found = find(name);
+  if (found == nullptr) {
+    throw std::runtime_error(archivePath.string() + " has no map named " +
+                             name + ".");
+  }
+  return *found;
+}
+
+Scalar MapArchive::pixel(const std::string &name, int row,
+                         int column) const {
+  Scalar value;
+  const Entry &map = entry(name);
+  if (row < 0 || row >= map.height || column < 0 || column >= map.width) {
+    throw std::out_of_range("Pixel (" + std::to_string(row) + ", " +
+                            std::to_string(column) + ") is outside of " +
+                            name + ".");
+  }
+  readRow(map, row, column, 1, &value);
+  return value;
+}
+
+Image MapArchive::tile(const std::string &name, int firstRow,
+                       int firstColumn, int height, int width) const {
+  const Entry &map = entry(name);
+  if (firstRow < 0 || firstColumn < 0 || height < 0 || width < 0 ||
+      firstRow + height > map.height || firstColumn + width > map.width) {
+    throw std::out_of_range("The tile is outside of " + name + ".");
+  }
+  Image tileImage(width, height);
+  for (int row = 0; row < height; ++row) {
+    readRow(map, firstRow + row, firstColumn, width, tileImage.rowData(row));
+  }
+  return tileImage;
+}
+
+Image MapArchive::image(const std::string &name) const {
+  const Entry &map = entry(name);
+  return tile(name, 0, 0, map.height, map.width);
+}
+
+void MapArchive::readRow(const Entry &map, int row, int firstColumn,
+                         int width, Scalar *destination) const {
+  const char *source =
+      file->begin() + map.offset +
+      (uint64_t(row) * map.width + firstColumn) * map.elementSize;
+  if (map.elementSize == sizeof(Scalar)) {
+    std::memcpy(destination, source, width * sizeof(Scalar));
+  } else if (map.elementSize == sizeof(float)) {
+    readElements<float>(source, width, destination);
+  } else {
+    readElements<double>(source, width, destination);
+  }
+}
@@ -0,0 +1,97 @@
+#ifndef MAP_ARCHIVE
+#define MAP_ARCHIVE
+
+#include "Image.hpp"
+#include "MappedFile.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A single file holding every map of a date, so that a date can be copied
+// and scanned as one file, and any pixel or tile of any map can be read
+// without loading the rest.
+//
+// Layout, in the byte order of the machine that wrote it:
+//
+//   header   "T2CA", uint32 version, uint64 index offset, uint64 map count
+//   maps     the pixels of each map in row-major order, as float64 or
+//            float32, each map starting on a 64 byte boundary
+//   index    for each map: uint64 offset, int32 width, int32 height,
+//            uint32 element size (8 or 4), uint32 name length, then the name
+//
+// Maps are named after the file they would otherwise be saved as, without
+// the extension, e.g. "2020-02-02_Conductance_3".
+
+// Writes an archive. Maps are appended as they are added, and the index is
+// written by close(). The archive is written under a temporary name and
+// only appears under its own name once it is complete. Not thread-safe.
+class MapArchiveWriter {
+public:
+  // Maps are stored as float32 if elementSize is 4, and float64 if it is 8.
+  MapArchiveWriter(const boost::filesystem::path &, int elementSize = 8);
+  // Abandons the archive if close() was not called.
+  ~MapArchiveWriter();
+
+  MapArchiveWriter(const MapArchiveWriter &) = delete;
+  MapArchiveWriter &operator=(const MapArchiveWriter &) = delete;
+
+  void add(const std::string &name, const Image &);
+  void close();
+
+private:
+  struct IndexEntry {
+    std::string name;
+    uint64_t offset;
+    int32_t width;
+    int32_t height;
+  };
+
+  boost::filesystem::path archivePath;
+  boost::filesystem::path temporaryPath;
+  std::ofstream outputFile;
+  uint32_t elementSize;
+  uint64_t position;
+  std::vector<IndexEntry> index;
+
+  void write(const void *data, size_t size);
+  void checkWritten();
+};
+
+// Serves pixels and tiles straight from a memory-mapped archive.
+class MapArchive {
+public:
+  struct Entry {
+    std::string name;
+    int width;
+    int height;
+    int elementSize;
+    uint64_t offset;
+  };
+
+  explicit MapArchive(const boost::filesystem::path &);
+
+  const std::vector<Entry> &entries() const { return index; }
+  // Returns null if the archive has no map with the name.
+  const Entry *find(const std::string &name) const;
+
+  Scalar pixel(const std::string &name, int row, int column) const;
+  // The tile of the map whose top left pixel is (firstRow, firstColumn).
+  // Throws std::out_of_range unless the tile lies inside the map.
+  Image tile(const std::string &name, int firstRow, int firstColumn,
+             int height, int width) const;
+  Image image(const std::string &name) const;
+
+private:
+  boost::filesystem::path archivePath;
+  std::unique_ptr<MappedFile> file;
+  std::vector<Entry> index;
+
+  const Entry &entry(const std::string &name) const;
+  void readRow(const Entry &, int row, int firstColumn, int width,
+               Scalar *destination) const;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#include "MappedFile.hpp"
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const boost::filesystem::path &path)
+    : contents(nullptr), length(0) {
+  int fileDescriptor = open(path.string().c_str(), O_RDONLY);
+  if (fileDescriptor < 0) {
+    throw std::runtime_error("BAD INPUT FILE: " + path.string());
+  }
+
+  struct stat fileStatus;
+  if (fstat(fileDescriptor, &fileStatus) != 0) {
+    close(fileDescriptor);
+    throw std::runtime_error("Unable to read the size of " + path.string());
+  }
+  length = static_cast<size_t>(fileStatus.st_size);
+
+  // mmap rejects zero length mappings, so an empty file is left unmapped.
+  if (length > 0) {
+    void *mapping =
+        mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+      close(fileDescriptor);
+      throw std::runtime_error("Unable to map file " + path.string());
+    }
+    contents = static_cast<const char *>(mapping);
+    madvise(mapping, length, MADV_SEQUENTIAL);
+  }
+  close(fileDescriptor);
+}
+
+MappedFile::~MappedFile() {
+  if (contents != nullptr) {
+    munmap(const_cast<char *>(contents), length);
+  }
+}
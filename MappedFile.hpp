@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+
+#include <boost/filesystem.hpp>
+#include <cstddef>
+
+// Read-only memory mapping of an entire file. Pages are only read from disk
+// once they are touched, so callers that stop scanning early never pay for
+// the rest of the file.
+class MappedFile {
+public:
+  explicit MappedFile(const boost::filesystem::path &);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *begin() const { return contents; }
+  const char *end() const { return contents + length; }
+  size_t size() const { return length; }
+
+private:
+  const char *contents;
+  size_t length;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "NpyFile.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+const char npyMagic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+const size_t npyAlignment = 64;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const char byteOrder = '>';
+#else
+const char byteOrder = '<';
+#endif
+
+std::string descriptionOf(NpyElementType elementType) {
+  return std::string(1, byteOrder) +
+         (elementType == NpyElementType::Float32 ? "f4" : "f8");
+}
+
+// Writes a row of pixels as elements of type T, converting them first unless
+// the image already holds T.
+template <typename T>
+void writeRow(std::ofstream &outputFile, const Scalar *values, int width,
+              std::vector<T> &convertedRow) {
+  if (std::is_same<T, Scalar>::value) {
+    outputFile.write(reinterpret_cast<const char *>(values),
+                     width * sizeof(Scalar));
+  } else {
+    convertedRow.assign(values, values + width);
+    outputFile.write(reinterpret_cast<const char *>(convertedRow.data()),
+                     convertedRow.size() * sizeof(T));
+  }
+}
+
+// Reads a row of elements of type T, which need not be aligned.
+template <typename T>
+void readRow(const char *source, int width, Scalar *destination) {
+  if (std::is_same<T, Scalar>::value) {
+    std::memcpy(destination, source, width * sizeof(Scalar));
+    return;
+  }
+  for (int column = 0; column < width; ++column) {
+    T value;
+    std::memcpy(&value, source + column * sizeof(T), sizeof(T));
+    destination[column] = static_cast<Scalar>(value);
+  }
+}
+
+// Returns the text following "'key':" in the header dictionary.
+std::string headerValue(const std::string &header, const std::string &key) {
+  auto keyStart = header.find("'" + key + "'");
+  if (keyStart == std::string::npos) {
+    throw std::runtime_error("The .npy header has no " + key + ".");
+  }
+  auto valueStart = header.find(':', keyStart);
+  if (valueStart == std::string::npos) {
+    throw std::runtime_error("The .npy header has no " + key + ".");
+  }
+  return header.substr(valueStart + 1);
+}
+
+} // namespace
+
+void writeNpy(const boost::filesystem::path &fileName, const Image &image,
+              NpyElementType elementType) {
+  std::ofstream outputFile(fileName.string(), std::ios::binary);
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + fileName.string());
+  }
+
+  std::string header = "{'descr': '" + descriptionOf(elementType) +
+                       "', 'fortran_order': False, 'shape': (" +
+                       std::to_string(image.height()) + ", " +
+                       std::to_string(image.width()) + "), }";
+  const size_t prefixLength = sizeof(npyMagic) + 2 + 2;
+  while ((prefixLength + header.size() + 1) % npyAlignment != 0) {
+    header.push_back(' ');
+  }
+  header.push_back('\n');
+
+  const uint16_t headerLength = header.size();
+  const char version[2] = {1, 0};
+  const char lengthBytes[2] = {static_cast<char>(headerLength & 0xff),
+                               static_cast<char>(headerLength >> 8)};
+  outputFile.write(npyMagic, sizeof(npyMagic));
+  outputFile.write(version, sizeof(version));
+  outputFile.write(lengthBytes, sizeof(lengthBytes));
+  outputFile.write(header.data(), header.size());
+
+  std::vector<float> floatRow;
+  std::vector<double> doubleRow;
+  for (int row = 0; row < image.height(); ++row) {
+    const Scalar *values = image.rowData(row);
+    if (elementType == NpyElementType::Float32) {
+      writeRow(outputFile, values, image.width(), floatRow);
+    } else {
+      writeRow(outputFile, values, image.width(), doubleRow);
+    }
+  }
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + fileName.string());
+  }
+}
+
+Image readNpy(const boost::filesystem::path &fileName,
+              const CropWindow &window) {
+  MappedFile file(fileName);
+  const char *contents = file.begin();
+  auto badFile = [&fileName](const std::string &problem) {
+    return std::runtime_error(fileName.string() + ": " + problem);
+  };
+
+  // Version 1 has a 2 byte header length, versions 2 and 3 a 4 byte one.
+  if (file.size() < 10 ||
+      std::memcmp(contents, npyMagic, sizeof(npyMagic)) != 0) {
+    throw badFile("Not a .npy file.");
+  }
+  const unsigned char *lengthBytes =
+      reinterpret_cast<const unsigned char *>(contents + 8);
+  size_t headerStart = 10;
+  size_t headerLength = lengthBytes[0] | (lengthBytes[1] << 8);
+  if (contents[6] != 1) {
+    if (file.size() < 12) {
+      throw badFile("Not a .npy file.");
+    }
+    headerStart = 12;
+    headerLength |= (lengthBytes[2] << 16) | (size_t(lengthBytes[3]) << 24);
+  }
+  if (headerStart + headerLength > file.size()) {
+    throw badFile("The .npy header is truncated.");
+  }
+  std::string header(contents + headerStart, headerLength);
+
+  std::string description = headerValue(header, "descr");
+  NpyElementType elementType;
+  if (description.find("'" + descriptionOf(NpyElementType::Float64) + "'") <
+      description.find(',')) {
+    elementType = NpyElementType::Float64;
+  } else if (description.find("'" +
+                              descriptionOf(NpyElementType::Float32) + "'") <
+             description.find(',')) {
+    elementType = NpyElementType::Float32;
+  } else {
+    throw badFile("Only float64 and float32 .npy files in the byte order of "
+                  "this machine can be read.");
+  }
+  std::string fortranOrder = headerValue(header, "fortran_order");
+  if (fortranOrder.find("False") > fortranOrder.find(',')) {
+    throw badFile("Only C ordered .npy files can be read.");
+  }
+  std::string shape = headerValue(header, "shape");
+  int height = 0;
+  int width = 0;
+  if (std::sscanf(shape.c_str(), " ( %d , %d )", &height, &width) != 2 ||
+      height < 0 || width < 0) {
+    throw badFile("Only 2-D .npy files can be read.");
+  }
+
+  const size_t elementSize =
+      elementType == NpyElementType::Float32 ? sizeof(float) : sizeof(double);
+  const char *pixels = contents + headerStart + headerLength;
+  if (file.size() - (headerStart + headerLength) <
+      size_t(height) * width * elementSize) {
+    throw badFile("The .npy file is truncated.");
+  }
+
+  // Row r and column c are line r + 1 and cell c + 1 of the same image
+  // saved as CSV.
+  int firstRow = std::max(0, window.topLeft.second - 1);
+  int lastRow = std::min(height, window.bottomRight.second);
+  int firstColumn = std::max(0, window.topLeft.first - 1);
+  int lastColumn = std::min(width, window.bottomRight.first);
+  if (firstRow >= lastRow || firstColumn >= lastColumn) {
+    return Image();
+  }
+
+  Image image(lastColumn - firstColumn, lastRow - firstRow);
+  for (int row = firstRow; row < lastRow; ++row) {
+    const char *source =
+        pixels + (size_t(row) * width + firstColumn) * elementSize;
+    Scalar *destination = image.rowData(row - firstRow);
+    if (elementType == NpyElementType::Float32) {
+      readRow<float>(source, image.width(), destination);
+    } else {
+      readRow<double>(source, image.width(), destination);
+    }
+  }
+  return image;
+}
@@ -0,0 +1,22 @@
+#ifndef NPY_FILE
+#define NPY_FILE
+
+#include "FrameReader.hpp"
+#include "Image.hpp"
+#include <boost/filesystem.hpp>
+
+// Images saved in the NumPy .npy format (version 1.0): a short text header
+// describing the element type and the (height, width) shape, followed by the
+// pixels in row-major order. The header is padded so that the pixels start
+// on a 64 byte boundary, which lets them be used straight from a memory
+// mapping, e.g. numpy.load(path, mmap_mode='r').
+
+enum class NpyElementType { Float64, Float32 };
+
+void writeNpy(const boost::filesystem::path &, const Image &, NpyElementType);
+
+// Reads a 2-D float64 or float32 .npy file, keeping the part inside the crop
+// window exactly as FrameReader would if the values were in a CSV file.
+Image readNpy(const boost::filesystem::path &, const CropWindow &);
+
+#endif
@@ -0,0 +1,120 @@
+#include "RunStatistics.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+std::string runStageName(RunStage stage) {
+  switch (stage) {
+  case RunStage::DirectoryScan:
+    return "directoryScan";
+  case RunStage::Parse:
+    return "parse";
+  case RunStage::Average:
+    return "average";
+  case RunStage::KMatrixLoad:
+    return "kMatrixLoad";
+  case RunStage::Conductance:
+    return "conductance";
+  case RunStage::Save:
+    return "save";
+  case RunStage::PixelSummary:
+    return "pixelSummary";
+  }
+  return "unknown";
+}
+
+RunStatistics::RunStatistics() : start(std::chrono::steady_clock::now()) {}
+
+void RunStatistics::record(RunStage stage,
+                           std::chrono::steady_clock::duration duration,
+                           uint64_t bytesRead, uint64_t bytesWritten,
+                           uint64_t pixels) {
+  Counters &stageCounters = counters[static_cast<int>(stage)];
+  stageCounters.calls.fetch_add(1, std::memory_order_relaxed);
+  stageCounters.nanoseconds.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(),
+      std::memory_order_relaxed);
+  stageCounters.bytesRead.fetch_add(bytesRead, std::memory_order_relaxed);
+  stageCounters.bytesWritten.fetch_add(bytesWritten,
+                                       std::memory_order_relaxed);
+  stageCounters.pixels.fetch_add(pixels, std::memory_order_relaxed);
+}
+
+StageTotals RunStatistics::totals(RunStage stage) const {
+  const Counters &stageCounters = counters[static_cast<int>(stage)];
+  StageTotals stageTotals;
+  stageTotals.calls = stageCounters.calls.load();
+  stageTotals.seconds = stageCounters.nanoseconds.load() / 1e9;
+  stageTotals.bytesRead = stageCounters.bytesRead.load();
+  stageTotals.bytesWritten = stageCounters.bytesWritten.load();
+  stageTotals.pixels = stageCounters.pixels.load();
+  return stageTotals;
+}
+
+double RunStatistics::wallSeconds() const {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void RunStatistics::writeReport(const boost::filesystem::path &path) const {
+  std::ofstream outputFile(path.string());
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + path.string());
+  }
+  rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  outputFile.precision(6);
+  outputFile << std::fixed;
+  outputFile << "{\n";
+  outputFile << "  \"wallSeconds\": " << wallSeconds() << ",\n";
+  outputFile << "  \"userSeconds\": "
+             << usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 << ",\n";
+  outputFile << "  \"systemSeconds\": "
+             << usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6 << ",\n";
+  outputFile << "  \"peakResidentBytes\": " << peakResidentBytes() << ",\n";
+  outputFile << "  \"stages\": {\n";
+  for (int i = 0; i < runStageCount; ++i) {
+    RunStage stage = static_cast<RunStage>(i);
+    StageTotals stageTotals = totals(stage);
+    outputFile << "    \"" << runStageName(stage) << "\": {\"calls\": "
+               << stageTotals.calls
+               << ", \"seconds\": " << stageTotals.seconds
+               << ", \"bytesRead\": " << stageTotals.bytesRead
+               << ", \"bytesWritten\": " << stageTotals.bytesWritten
+               << ", \"pixels\": " << stageTotals.pixels << "}"
+               << (i + 1 < runStageCount ? ",\n" : "\n");
+  }
+  outputFile << "  }\n";
+  outputFile << "}\n";
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + path.string());
+  }
+}
+
+uint64_t peakResidentBytes() {
+  rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  // macOS reports bytes, Linux kilobytes.
+  return usage.ru_maxrss;
+#else
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+StageTimer::StageTimer(RunStatistics *statistics, RunStage stage)
+    : statistics(statistics), stage(stage), bytesRead(0), bytesWritten(0),
+      pixels(0) {
+  if (statistics) {
+    start = std::chrono::steady_clock::now();
+  }
+}
+
+StageTimer::~StageTimer() {
+  if (statistics) {
+    statistics->record(stage, std::chrono::steady_clock::now() - start,
+                       bytesRead, bytesWritten, pixels);
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef RUN_STATISTICS
+#define RUN_STATISTICS
+
+#include <array>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// The stages of a run that are timed.
+enum class RunStage {
+  // Finding the frames of each image.
+  DirectoryScan,
+  // Loading temperature and calibration frames.
+  Parse,
+  // Folding frames into average images.
+  Average,
+  // Loading and averaging the frames of K matrices.
+  KMatrixLoad,
+  // Calculating conductance maps and K matrices.
+  Conductance,
+  // Saving images, map archives and time series.
+  Save,
+  // Writing PixelAnalysis.csv and PixelTable.csv.
+  PixelSummary
+};
+
+const int runStageCount = 7;
+
+std::string runStageName(RunStage);
+
+// What a stage did over the whole run.
+struct StageTotals {
+  uint64_t calls;
+  // Summed over every thread that ran the stage, so stages running on the
+  // thread pool can take longer than the run itself.
+  double seconds;
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint64_t pixels;
+};
+
+// Totals of every stage of a run, and the run's time and peak memory. Stages
+// may be recorded from any thread; each record is a few atomic additions.
+class RunStatistics {
+public:
+  RunStatistics();
+
+  void record(RunStage, std::chrono::steady_clock::duration, uint64_t bytesRead,
+              uint64_t bytesWritten, uint64_t pixels);
+
+  StageTotals totals(RunStage) const;
+  // Seconds since the statistics were created.
+  double wallSeconds() const;
+
+  // Writes the totals as a JSON object. Throws if the file cannot be
+  // written.
+  void writeReport(const boost::filesystem::path &) const;
+
+private:
+  struct Counters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<int64_t> nanoseconds{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<uint64_t> pixels{0};
+  };
+
+  std::chrono::steady_clock::time_point start;
+  std::array<Counters, runStageCount> counters;
+};
+
+// The peak resident set size of the process so far, in bytes.
+uint64_t peakResidentBytes();
+
+// Times a stage from construction to destruction, along with what it read,
+// wrote and processed. Does nothing without statistics.
+class StageTimer {
+public:
+  StageTimer(RunStatistics *, RunStage);
+  ~StageTimer();
+
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+
+  bool enabled() const { return statistics != nullptr; }
+  void addBytesRead(uint64_t bytes) { bytesRead += bytes; }
+  void addBytesWritten(uint64_t bytes) { bytesWritten += bytes; }
+  void addPixels(uint64_t count) { pixels += count; }
+
+private:
+  RunStatistics *statistics;
+  RunStage stage;
+  std::chrono::steady_clock::time_point start;
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint64_t pixels;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "SyntheticData.hpp"
+#include "ImageWriter.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+struct Leaflet {
+  double row;
+  double column;
+  double radius;
+  double cooling;
+};
+
+// Writes the image as a radiometric export, to two decimals.
+uintmax_t writeFrame(const boost::filesystem::path &fileName,
+                     const Image &frame) {
+  std::string text;
+  text.reserve(frame.size() * 7);
+  char value[32];
+  for (int row = 0; row < frame.height(); ++row) {
+    for (int column = 0; column < frame.width(); ++column) {
+      if (column > 0) {
+        text.push_back(',');
+      }
+      auto result = std::to_chars(value, value + sizeof(value),
+                                  double(frame(row, column)),
+                                  std::chars_format::fixed, 2);
+      text.append(value, result.ptr);
+    }
+    text.push_back('\n');
+  }
+
+  std::ofstream outputFile(fileName.string(), std::ios::binary);
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + fileName.string());
+  }
+  outputFile.write(text.data(), text.size());
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + fileName.string());
+  }
+  return text.size();
+}
+
+} // namespace
+
+SyntheticData writeSyntheticData(const boost::filesystem::path &base,
+                                 const SyntheticDataOptions &options) {
+  if (options.width < 1 || options.height < 1 || options.imageCount < 1 ||
+      options.framesPerImage < 1 || options.kMatrixCount < 1) {
+    throw std::runtime_error("Synthetic data needs at least one pixel, image, "
+                             "frame and K matrix.");
+  }
+  boost::filesystem::path dateDirectory = base / "Data" / options.date;
+  boost::filesystem::path framesDirectory = dateDirectory / "TempImages";
+  boost::filesystem::path kMatrixDirectory = base / "KMatrix";
+  boost::filesystem::create_directories(framesDirectory);
+  boost::filesystem::create_directories(kMatrixDirectory);
+
+  std::mt19937 generator(options.seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::normal_distribution<double> noise(0.0, 0.15);
+
+  // The leaf is the same in every image; only the temperatures change.
+  std::vector<Leaflet> leaflets;
+  const double leafletRadius = std::max(2, std::min(options.width,
+                                                    options.height) /
+                                               20);
+  const int leafletCount =
+      std::max(1, options.width * options.height /
+                      int(16 * leafletRadius * leafletRadius));
+  for (int i = 0; i < leafletCount; ++i) {
+    leaflets.push_back({uniform(generator) * options.height,
+                        uniform(generator) * options.width,
+                        leafletRadius * (0.5 + uniform(generator)),
+                        0.5 + 2.5 * uniform(generator)});
+  }
+  Image leaf(options.width, options.height);
+  for (int row = 0; row < options.height; ++row) {
+    for (int column = 0; column < options.width; ++column) {
+      double temperature = 1.5 * column / options.width;
+      for (auto &&leaflet : leaflets) {
+        double rowDistance = (row - leaflet.row) / leaflet.radius;
+        double columnDistance = (column - leaflet.column) / leaflet.radius;
+        double distance =
+            rowDistance * rowDistance + columnDistance * columnDistance;
+        if (distance < 4.0) {
+          temperature -= leaflet.cooling * std::exp(-distance);
+        }
+      }
+      leaf(row, column) = temperature;
+    }
+  }
+
+  SyntheticData data;
+  data.frameBytes = 0;
+  ImageWriter writer;
+  for (int k = 1; k <= options.kMatrixCount; ++k) {
+    Image kMatrix(options.width, options.height);
+    double level = 5.0 + 10.0 * uniform(generator);
+    for (int row = 0; row < options.height; ++row) {
+      for (int column = 0; column < options.width; ++column) {
+        kMatrix(row, column) = level + 0.5 * std::sin(0.05 * row) +
+                               0.5 * std::cos(0.05 * column);
+      }
+    }
+    boost::filesystem::path fileName =
+        kMatrixDirectory / ("KMatrix_K" + std::to_string(k) + ".csv");
+    writer.save(fileName, kMatrix);
+    data.kMatrixFiles.push_back(fileName);
+  }
+
+  std::ofstream programData((dateDirectory / "DataExtraction.csv").string());
+  if (!programData.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " +
+                             (dateDirectory / "DataExtraction.csv").string());
+  }
+  Image frame(options.width, options.height);
+  for (int image = 1; image <= options.imageCount; ++image) {
+    std::string identifier = std::to_string(image);
+    double background = 25.0 + 0.5 * image;
+    double airTemperature = background - 3.0;
+    programData << identifier << ",K"
+                << (image - 1) % options.kMatrixCount + 1 << ","
+                << airTemperature << "," << airTemperature + 1.0 << ","
+                << airTemperature - 0.5 << "," << airTemperature + 0.5 << ","
+                << 0.010 + 0.001 * image << "\n";
+
+    data.imageIdentifiers.push_back(identifier);
+    data.frames.emplace_back();
+    for (int f = 0; f < options.framesPerImage; ++f) {
+      for (int row = 0; row < options.height; ++row) {
+        for (int column = 0; column < options.width; ++column) {
+          frame(row, column) =
+              background + leaf(row, column) + noise(generator);
+        }
+      }
+      boost::filesystem::path fileName =
+          framesDirectory /
+          ("img_" + identifier + "_f" + std::to_string(f) + ".csv");
+      data.frameBytes += writeFrame(fileName, frame);
+      data.frames.back().push_back(fileName);
+    }
+  }
+  programData.close();
+  if (programData.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " +
+                             (dateDirectory / "DataExtraction.csv").string());
+  }
+  return data;
+}
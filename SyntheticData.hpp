@@ -0,0 +1,50 @@
+#ifndef SYNTHETIC_DATA
+#define SYNTHETIC_DATA
+
+#include "Image.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The shape of a synthetic experiment.
+struct SyntheticDataOptions {
+  SyntheticDataOptions()
+      : width(640), height(480), imageCount(4), framesPerImage(10),
+        kMatrixCount(2), seed(1), date("2000-01-01") {}
+
+  int width;
+  int height;
+  int imageCount;
+  int framesPerImage;
+  int kMatrixCount;
+  unsigned seed;
+  std::string date;
+};
+
+// What writeSyntheticData wrote, for the benchmarks to work through.
+struct SyntheticData {
+  std::vector<std::string> imageIdentifiers;
+  // The frames of each image, in the order of imageIdentifiers.
+  std::vector<std::vector<boost::filesystem::path>> frames;
+  std::vector<boost::filesystem::path> kMatrixFiles;
+  // The total size of every frame file.
+  uintmax_t frameBytes;
+};
+
+// Writes a date laid out like the lab data under the base directory:
+//
+//   Data/DATE/DataExtraction.csv   one row per image, cycling through the
+//                                  K matrices
+//   Data/DATE/TempImages/          radiometric CSV frames named
+//                                  img_ID_fFRAME.csv
+//   KMatrix/KMatrix_KID.csv        one K matrix per calibration
+//
+// Frames look like a thermal camera export of a leaf: a warm background
+// with a slow gradient, cooler leaflets where stomata are open, and sensor
+// noise, printed to two decimals. Identifiers are 1, 2, ... and K matrix
+// identifiers K1, K2, ...
+SyntheticData writeSyntheticData(const boost::filesystem::path &base,
+                                 const SyntheticDataOptions &);
+
+#endif
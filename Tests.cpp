@@ -0,0 +1,833 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BatchRunner.hpp"
+#include "BoxFilter.hpp"
+#include "DirectoryIndex.hpp"
+#include "FrameCache.hpp"
+#include "FrameReader.hpp"
+#include "InputManifest.hpp"
+#include "IntegralImage.hpp"
+#include "MapArchive.hpp"
+#include "NpyFile.hpp"
+#include "SyntheticData.hpp"
+#include "TimeSeriesStore.hpp"
+
+// Round trips and error paths of the parsers and file formats. Each group of
+// checks is a test of its own, so that ctest reports them separately:
+//
+//   TemperatureToConductanceTests [GROUP...]
+//
+// runs the named groups, or all of them.
+
+namespace {
+
+using Path = boost::filesystem::path;
+
+int failures = 0;
+
+void check(bool passed, const std::string &description) {
+  if (!passed) {
+    ++failures;
+    std::cout << "FAILED: " << description << std::endl;
+  }
+}
+
+template <typename Exception = std::exception>
+void checkThrows(const std::function<void()> &action,
+                 const std::string &description) {
+  try {
+    action();
+  } catch (const Exception &) {
+    return;
+  } catch (...) {
+    check(false, description + " threw the wrong exception");
+    return;
+  }
+  check(false, description + " did not throw");
+}
+
+// A fresh directory, removed with everything in it when the test is done.
+class TemporaryDirectory {
+public:
+  TemporaryDirectory()
+      : path(boost::filesystem::temp_directory_path() /
+             boost::filesystem::unique_path("t2c-tests-%%%%-%%%%-%%%%")) {
+    boost::filesystem::create_directories(path);
+  }
+  ~TemporaryDirectory() {
+    boost::system::error_code ignored;
+    boost::filesystem::remove_all(path, ignored);
+  }
+
+  TemporaryDirectory(const TemporaryDirectory &) = delete;
+  TemporaryDirectory &operator=(const TemporaryDirectory &) = delete;
+
+  const Path path;
+};
+
+void writeText(const Path &path, const std::string &text) {
+  std::ofstream file(path.string(), std::ios::binary);
+  file << text;
+}
+
+std::string readText(const Path &path) {
+  std::ifstream file(path.string(), std::ios::binary);
+  std::ostringstream text;
+  text << file.rdbuf();
+  return text.str();
+}
+
+// Keeps the first size bytes of the file.
+void truncateFile(const Path &path, size_t size) {
+  std::string text = readText(path);
+  writeText(path, text.substr(0, size));
+}
+
+// An image whose pixels are all different and not integers.
+Image numberedImage(int width, int height, double offset = 0.0) {
+  Image image(width, height);
+  for (int row = 0; row < height; ++row) {
+    for (int column = 0; column < width; ++column) {
+      image(row, column) = offset + row * 10.25 + column * 0.5 - 3.0;
+    }
+  }
+  return image;
+}
+
+// The image as a CSV frame, exactly.
+std::string csvText(const Image &image) {
+  std::ostringstream text;
+  text.precision(17);
+  for (int row = 0; row < image.height(); ++row) {
+    for (int column = 0; column < image.width(); ++column) {
+      text << (column == 0 ? "" : ",") << double(image(row, column));
+    }
+    text << "\n";
+  }
+  return text.str();
+}
+
+bool sameImage(const Image &a, const Image &b) {
+  if (!a.hasSameDimensions(b)) {
+    return false;
+  }
+  for (int row = 0; row < a.height(); ++row) {
+    for (int column = 0; column < a.width(); ++column) {
+      if (a(row, column) != b(row, column)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// The part of the image a crop window keeps, with the window's 1-based
+// coordinates.
+Image croppedImage(const Image &image, const CropWindow &window) {
+  int width = window.bottomRight.first - window.topLeft.first + 1;
+  int height = window.bottomRight.second - window.topLeft.second + 1;
+  Image cropped(width, height);
+  for (int row = 0; row < height; ++row) {
+    for (int column = 0; column < width; ++column) {
+      cropped(row, column) = image(row + window.topLeft.second - 1,
+                                   column + window.topLeft.first - 1);
+    }
+  }
+  return cropped;
+}
+
+const CropWindow wholeFrame = {Coordinate(1, 1), Coordinate(100000, 100000)};
+
+////////////////////////////////////////////////////////////////////////////////
+/* FRAME READER */
+
+void testFrameReader() {
+  // The fast path must round exactly as strtod does, and hand anything it
+  // cannot convert exactly to strtod.
+  const char *numbers[] = {
+      "0",      "-0",         "21.37",    "  3.5",   "+7",
+      "0.1",    "-273.15",    "1e-5",     "2.5E22",  "2.5e23",
+      "1e-22",  "1e-23",      "9007199254740993",   "123456789012345678901",
+      "0.000000000000000000000000123",  "1.7976931348623157e308",
+      "4.9e-324", "31.999999999999999999", "nan", "inf", "-inf"};
+  for (auto &&number : numbers) {
+    double parsed = parseDecimal(number, number + std::strlen(number));
+    double expected = std::strtod(number, nullptr);
+    check(std::memcmp(&parsed, &expected, sizeof(double)) == 0 ||
+              (std::isnan(parsed) && std::isnan(expected)),
+          std::string("parseDecimal(\"") + number + "\") matches strtod");
+  }
+  // Only the number is read, as std::stod does.
+  const char trailing[] = "12.5\r";
+  check(parseDecimal(trailing, trailing + 5) == 12.5,
+        "parseDecimal ignores what follows the number");
+  const char notANumber[] = "abc";
+  checkThrows([&] { parseDecimal(notANumber, notANumber + 3); },
+              "parseDecimal of \"abc\"");
+
+  TemporaryDirectory directory;
+  Image frame = numberedImage(5, 4);
+  Path framePath = directory.path / "frame.csv";
+  writeText(framePath, csvText(frame));
+  check(sameImage(FrameReader(wholeFrame).read(framePath), frame),
+        "FrameReader reads a whole frame");
+  CropWindow window = {Coordinate(2, 2), Coordinate(4, 3)};
+  check(sameImage(FrameReader(window).read(framePath),
+                  croppedImage(frame, window)),
+        "FrameReader keeps only the crop window");
+
+  // A row that ends inside the crop window cannot make a rectangular frame.
+  writeText(framePath, "1,2,3,4\n5,6,7,8\n9,10\n11,12,13,14\n");
+  checkThrows<std::runtime_error>(
+      [&] { FrameReader(wholeFrame).read(framePath); }, "A ragged frame");
+  check(FrameReader({Coordinate(1, 1), Coordinate(2, 4)})
+                .read(framePath)
+                .width() == 2,
+        "A short row outside the crop window is not an error");
+  checkThrows<std::runtime_error>(
+      [&] { FrameReader(wholeFrame).read(directory.path / "missing.csv"); },
+      "Reading a frame that does not exist");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* FRAME CACHE */
+
+// The offset of the width in the header documented in FrameCache.hpp.
+const size_t cachedWidthOffset = 40;
+
+std::vector<Path> filesIn(const Path &directory) {
+  std::vector<Path> files;
+  boost::filesystem::directory_iterator endItr;
+  for (boost::filesystem::directory_iterator itr(directory); itr != endItr;
+       ++itr) {
+    files.push_back(itr->path());
+  }
+  return files;
+}
+
+void testFrameCache() {
+  TemporaryDirectory directory;
+  Path framePath = directory.path / "img_1_a.csv";
+  Image frame = numberedImage(6, 5);
+  writeText(framePath, csvText(frame));
+  CropWindow window = {Coordinate(2, 1), Coordinate(5, 4)};
+  FrameCache cache(window);
+  Path cachePath = cache.cachePathFor(framePath);
+
+  check(sameImage(cache.load(framePath), croppedImage(frame, window)),
+        "FrameCache parses an uncached frame");
+  check(boost::filesystem::exists(cachePath), "FrameCache caches a frame");
+  check(filesIn(cachePath.parent_path()).size() == 1,
+        "FrameCache leaves no temporary files behind");
+
+  // Changing a pixel in the cache file shows the frame was read from it.
+  std::string cached = readText(cachePath);
+  Scalar marker = 12345.0;
+  std::memcpy(&cached[cached.size() - sizeof(Scalar)], &marker,
+              sizeof(Scalar));
+  writeText(cachePath, cached);
+  Image fromCache = cache.load(framePath);
+  check(fromCache(fromCache.height() - 1, fromCache.width() - 1) == marker,
+        "FrameCache reads a valid cache file");
+
+  // A cache of another crop window is not used.
+  CropWindow otherWindow = {Coordinate(1, 1), Coordinate(6, 5)};
+  check(sameImage(FrameCache(otherWindow).load(framePath), frame),
+        "FrameCache keeps a cache file per crop window");
+
+  // Editing the frame makes its cache file stale.
+  Image editedFrame = numberedImage(6, 5, 100.0);
+  writeText(framePath, csvText(editedFrame) + "\n");
+  check(sameImage(cache.load(framePath), croppedImage(editedFrame, window)),
+        "FrameCache re-parses a frame edited since it was cached");
+
+  // A corrupt header must not be trusted, however large it claims the frame
+  // is, and neither must a truncated cache file.
+  cached = readText(cachePath);
+  uint32_t hugeWidth = 0x7fffffff;
+  std::memcpy(&cached[cachedWidthOffset], &hugeWidth, sizeof(hugeWidth));
+  writeText(cachePath, cached);
+  check(sameImage(cache.load(framePath), croppedImage(editedFrame, window)),
+        "FrameCache re-parses a frame whose cache header is corrupt");
+  truncateFile(cachePath, readText(cachePath).size() - 3);
+  check(sameImage(cache.load(framePath), croppedImage(editedFrame, window)),
+        "FrameCache re-parses a frame whose cache file is truncated");
+  truncateFile(cachePath, 10);
+  check(sameImage(cache.load(framePath), croppedImage(editedFrame, window)),
+        "FrameCache re-parses a frame whose cache header is truncated");
+  check(readText(cachePath).size() > 10,
+        "FrameCache replaces a bad cache file");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* DIRECTORY INDEX */
+
+bool indexHolds(const DirectoryIndex &index, const std::string &identifier,
+                const std::vector<std::string> &names) {
+  std::vector<std::string> found;
+  for (auto &&path : index.filesWithIdentifier(identifier)) {
+    found.push_back(path.filename().string());
+  }
+  return found == names;
+}
+
+void testDirectoryIndex() {
+  TemporaryDirectory directory;
+  for (auto &&name :
+       {"1-12.csv", "img_12_a.csv", "img_12_b.csv", "KMatrix_K5.csv",
+        "2020-02-02_3_a.csv", "1_2.csv", "notes.txt", "img_120_a.csv",
+        ".hidden_3.csv"}) {
+    writeText(directory.path / name, "1\n");
+  }
+  boost::filesystem::create_directory(directory.path / "3");
+
+  DirectoryIndex index(directory.path, {"1", "12", "K5", "3", "1_2", "2"});
+  check(indexHolds(index, "1", {"1-12.csv"}),
+        "An identifier followed by another one only matches the first");
+  check(indexHolds(index, "12", {"img_12_a.csv", "img_12_b.csv"}),
+        "An identifier matches after a prefix, but not inside a token");
+  check(indexHolds(index, "K5", {"KMatrix_K5.csv"}),
+        "A K matrix identifier matches its file");
+  check(indexHolds(index, "3", {"2020-02-02_3_a.csv"}),
+        "An identifier matches after a date, but hidden files and "
+        "directories are skipped");
+  check(indexHolds(index, "2", {}), "\"02\" is not the identifier 2");
+  check(indexHolds(index, "1_2", {}) &&
+            index.ambiguousFiles().size() == 1 &&
+            index.ambiguousFiles()[0].first.filename() == "1_2.csv" &&
+            index.ambiguousFiles()[0].second.size() == 2,
+        "A file carrying two identifiers is ambiguous and left out");
+  check(index.unmatchedFiles().size() == 2,
+        "Files carrying no identifier are unmatched");
+  check(indexHolds(index, "unknown", {}),
+        "An identifier that was not asked for has no files");
+
+  std::ostringstream report;
+  index.reportProblems(report, "test directory");
+  check(report.str().find("notes.txt") != std::string::npos &&
+            report.str().find("1_2.csv") != std::string::npos,
+        "reportProblems names the unmatched and ambiguous files");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* INTEGRAL IMAGES */
+
+// The windows the leaflet means are checked with, down to one pixel and up
+// to windows larger than the test images.
+const LeafletWindow testWindows[] = {LeafletWindow(1, 1), LeafletWindow(3, 3),
+                                     LeafletWindow(4, 2), LeafletWindow(2, 5),
+                                     LeafletWindow(7, 5),
+                                     LeafletWindow(25, 25)};
+
+// The mean of the window around the pixel, added up pixel by pixel, or NaN if
+// the window holds a non-finite pixel.
+double windowMean(const Image &image, int row, int column,
+                  const LeafletWindow &window) {
+  double sum = 0.0;
+  int pixelCount = 0;
+  bool allFinite = true;
+  for (int r = row - (window.height - 1) / 2; r <= row + window.height / 2;
+       ++r) {
+    for (int c = column - (window.width - 1) / 2;
+         c <= column + window.width / 2; ++c) {
+      if (r >= 0 && r < image.height() && c >= 0 && c < image.width()) {
+        allFinite = allFinite && std::isfinite(image(r, c));
+        sum += image(r, c);
+        ++pixelCount;
+      }
+    }
+  }
+  return allFinite ? sum / pixelCount : std::nan("");
+}
+
+// Whether two means agree to the given relative tolerance, or are both NaN.
+bool sameMean(double a, double b, double tolerance = 1e-9) {
+  if (std::isnan(a) || std::isnan(b)) {
+    return std::isnan(a) && std::isnan(b);
+  }
+  return std::abs(a - b) <= tolerance * std::max(1.0, std::abs(b));
+}
+
+// A test image with a NaN, and an infinity of each sign side by side, whose
+// windows a box filter slides into and out of.
+Image imageWithNonFinitePixels() {
+  Image image = numberedImage(11, 8);
+  image(2, 3) = std::nan("");
+  image(5, 7) = std::numeric_limits<Scalar>::infinity();
+  image(5, 8) = -std::numeric_limits<Scalar>::infinity();
+  return image;
+}
+
+void checkIntegralImageMeans(const Image &image,
+                             const std::string &description) {
+  IntegralImage integralImage(image);
+  for (auto &&window : testWindows) {
+    bool meansMatch = true;
+    for (int row = 0; row < image.height(); ++row) {
+      for (int column = 0; column < image.width(); ++column) {
+        meansMatch =
+            meansMatch &&
+            sameMean(integralImage.mean(Coordinate(column, row), window),
+                     windowMean(image, row, column, window));
+      }
+    }
+    check(meansMatch, "IntegralImage gives every " +
+                          std::to_string(window.width) + "x" +
+                          std::to_string(window.height) + " mean of " +
+                          description);
+  }
+}
+
+void testIntegralImage() {
+  checkIntegralImageMeans(numberedImage(11, 8), "a finite image");
+  Image image = imageWithNonFinitePixels();
+  checkIntegralImageMeans(image, "an image with non-finite pixels");
+
+  IntegralImage integralImage(image);
+  check(integralImage.sum(0, 0, 2, 11) == windowMean(image, 0, 5, {11, 2}) * 22,
+        "A sum above a non-finite pixel is finite");
+  check(std::isnan(integralImage.sum(5, 7, 6, 9)),
+        "A sum holding an infinity of each sign is NaN");
+  check(integralImage.sum(3, 3, 3, 9) == 0.0 &&
+            integralImage.sum(-5, 20, 10, 30) == 0.0,
+        "An empty sum is zero");
+  checkThrows<std::out_of_range>(
+      [&] { integralImage.mean(Coordinate(11, 0), LeafletWindow()); },
+      "A mean around a pixel outside the image");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* BOX FILTER */
+
+void testBoxFilter() {
+  // The wide image has non-finite pixels at its corners and edges, and rows
+  // longer than the vectors of every instruction set, with some left over.
+  Image wideImage = numberedImage(37, 9);
+  wideImage(0, 0) = std::nan("");
+  wideImage(4, 18) = std::nan("");
+  wideImage(8, 35) = std::numeric_limits<Scalar>::infinity();
+  wideImage(8, 36) = -std::numeric_limits<Scalar>::infinity();
+  const std::pair<std::string, Image> images[] = {
+      {"a finite image", numberedImage(11, 8)},
+      {"an image with non-finite pixels", imageWithNonFinitePixels()},
+      {"a wide image with non-finite pixels", wideImage},
+      {"a single pixel", numberedImage(1, 1)}};
+
+  // The filtered image is rounded to Scalar, and its sums slide rather than
+  // being looked up.
+  double tolerance = 4 * std::numeric_limits<Scalar>::epsilon();
+  for (int instructionSet = 0;
+       instructionSet <= int(bestKernelInstructionSet()); ++instructionSet) {
+    KernelInstructionSet kernel = KernelInstructionSet(instructionSet);
+    for (auto &&image : images) {
+      IntegralImage integralImage(image.second);
+      for (auto &&window : testWindows) {
+        // The converter filters bands of rows on several threads.
+        const int rowsPerBand = 3;
+        BasicImage<double> rowMeans(image.second.width(),
+                                    image.second.height());
+        Image banded(image.second.width(), image.second.height());
+        for (int row = 0; row < image.second.height(); row += rowsPerBand) {
+          int lastRow = std::min(row + rowsPerBand, image.second.height());
+          boxFilterHorizontal(image.second, window.width, rowMeans, row,
+                              lastRow);
+        }
+        for (int row = 0; row < image.second.height(); row += rowsPerBand) {
+          int lastRow = std::min(row + rowsPerBand, image.second.height());
+          boxFilterVertical(rowMeans, window.height, banded, row, lastRow,
+                            kernel);
+        }
+
+        const std::pair<std::string, Image> filteredImages[] = {
+            {"", boxFilter(image.second, window, kernel)},
+            {" in bands", banded}};
+        for (auto &&filtered : filteredImages) {
+          const Image &means = filtered.second;
+          bool meansMatch = means.hasSameDimensions(image.second);
+          for (int row = 0; meansMatch && row < means.height(); ++row) {
+            for (int column = 0; column < means.width(); ++column) {
+              meansMatch =
+                  meansMatch &&
+                  sameMean(means(row, column),
+                           integralImage.mean(Coordinate(column, row), window),
+                           tolerance);
+            }
+          }
+          check(meansMatch, "The " + kernelInstructionSetName(kernel) +
+                                " box filter gives every " +
+                                std::to_string(window.width) + "x" +
+                                std::to_string(window.height) + " mean of " +
+                                image.first + filtered.first +
+                                " as IntegralImage does");
+        }
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* NPY FILES */
+
+void testNpyFile() {
+  TemporaryDirectory directory;
+  Image image = numberedImage(7, 5);
+  Path npyPath = directory.path / "image.npy";
+
+  writeNpy(npyPath, image, NpyElementType::Float64);
+  check(sameImage(readNpy(npyPath, wholeFrame), image),
+        "A float64 .npy file reads back exactly");
+  // Cropping must keep what FrameReader keeps of the same values.
+  Path csvPath = directory.path / "image.csv";
+  writeText(csvPath, csvText(image));
+  for (auto &&window :
+       {CropWindow{Coordinate(2, 3), Coordinate(6, 4)},
+        CropWindow{Coordinate(1, 1), Coordinate(3, 100)},
+        CropWindow{Coordinate(7, 5), Coordinate(7, 5)}}) {
+    check(sameImage(readNpy(npyPath, window),
+                    FrameReader(window).read(csvPath)),
+          "A cropped .npy file matches the cropped CSV file");
+  }
+
+  writeNpy(npyPath, image, NpyElementType::Float32);
+  Image rounded = readNpy(npyPath, wholeFrame);
+  bool roundedToFloat = rounded.hasSameDimensions(image);
+  for (int row = 0; roundedToFloat && row < image.height(); ++row) {
+    for (int column = 0; column < image.width(); ++column) {
+      roundedToFloat = roundedToFloat &&
+                       rounded(row, column) ==
+                           static_cast<float>(image(row, column));
+    }
+  }
+  check(roundedToFloat, "A float32 .npy file reads back rounded to float");
+
+  std::string npy = readText(npyPath);
+  check(npy.size() % 64 == (image.size() * sizeof(float)) % 64,
+        "The pixels of a .npy file start on a 64 byte boundary");
+  truncateFile(npyPath, npy.size() - 1);
+  checkThrows<std::runtime_error>([&] { readNpy(npyPath, wholeFrame); },
+                                  "Reading a truncated .npy file");
+  truncateFile(npyPath, 20);
+  checkThrows<std::runtime_error>([&] { readNpy(npyPath, wholeFrame); },
+                                  "Reading a truncated .npy header");
+  checkThrows<std::runtime_error>([&] { readNpy(csvPath, wholeFrame); },
+                                  "Reading a CSV file as .npy");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* MAP ARCHIVES */
+
+void testMapArchive() {
+  TemporaryDirectory directory;
+  Path archivePath = directory.path / "maps.t2ca";
+  Image first = numberedImage(5, 3);
+  Image second = numberedImage(1, 1, 42.0);
+  {
+    MapArchiveWriter writer(archivePath);
+    writer.add("2020-02-02_Conductance_1", first);
+    writer.add("2020-02-02_Conductance_2", second);
+    check(!boost::filesystem::exists(archivePath),
+          "An archive only appears once it is closed");
+    writer.close();
+  }
+
+  MapArchive archive(archivePath);
+  check(archive.entries().size() == 2 &&
+            archive.entries()[0].name == "2020-02-02_Conductance_1" &&
+            archive.entries()[0].width == 5 &&
+            archive.entries()[0].height == 3 &&
+            archive.entries()[0].offset % 64 == 0 &&
+            archive.entries()[1].offset % 64 == 0,
+        "The archive index lists every map, aligned");
+  check(sameImage(archive.image("2020-02-02_Conductance_1"), first) &&
+            sameImage(archive.image("2020-02-02_Conductance_2"), second),
+        "Archived maps read back exactly");
+  check(archive.pixel("2020-02-02_Conductance_1", 2, 4) == first(2, 4),
+        "A pixel reads back from the archive");
+  Image tile = archive.tile("2020-02-02_Conductance_1", 1, 2, 2, 3);
+  check(sameImage(tile, croppedImage(first, {Coordinate(3, 2),
+                                             Coordinate(5, 3)})),
+        "A tile reads back from the archive");
+  check(archive.find("missing") == nullptr,
+        "find returns null for a map the archive does not have");
+  checkThrows<std::out_of_range>(
+      [&] { archive.tile("2020-02-02_Conductance_1", 2, 2, 2, 2); },
+      "A tile reaching past the map");
+  checkThrows<std::out_of_range>(
+      [&] { archive.pixel("2020-02-02_Conductance_2", 0, 1); },
+      "A pixel outside the map");
+  checkThrows<std::runtime_error>([&] { archive.image("missing"); },
+                                  "Reading a map the archive does not have");
+
+  Path float32Path = directory.path / "maps32.t2ca";
+  {
+    MapArchiveWriter writer(float32Path, 4);
+    writer.add("map", first);
+    writer.close();
+  }
+  check(MapArchive(float32Path).image("map")(1, 1) ==
+            static_cast<float>(first(1, 1)),
+        "A float32 archive reads back rounded to float");
+
+  // An archive that was never closed is abandoned.
+  Path abandonedPath = directory.path / "abandoned.t2ca";
+  {
+    MapArchiveWriter writer(abandonedPath);
+    writer.add("map", first);
+  }
+  check(filesIn(directory.path).size() == 2,
+        "An archive that was not closed leaves no files behind");
+
+  size_t archiveSize = boost::filesystem::file_size(archivePath);
+  truncateFile(archivePath, archiveSize - 4);
+  checkThrows<std::runtime_error>([&] { MapArchive{archivePath}; },
+                                  "Opening an archive with a truncated index");
+  truncateFile(archivePath, 8);
+  checkThrows<std::runtime_error>([&] { MapArchive{archivePath}; },
+                                  "Opening an archive with a truncated header");
+  writeText(archivePath, "Image identifier,Frames\n");
+  checkThrows<std::runtime_error>([&] { MapArchive{archivePath}; },
+                                  "Opening a file that is not an archive");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* TIME SERIES STORES */
+
+void testTimeSeriesStore() {
+  TemporaryDirectory directory;
+  Path storePath = directory.path / "series.t2cs";
+  const int width = 4;
+  const int height = 3;
+  std::vector<std::string> identifiers = {"1", "2", "10"};
+  std::vector<Image> temperatures;
+  std::vector<Image> conductances;
+  for (size_t image = 0; image < identifiers.size(); ++image) {
+    temperatures.push_back(numberedImage(width, height, 20.0 + image));
+    conductances.push_back(numberedImage(width, height, -0.5 * image));
+  }
+  {
+    TimeSeriesWriter writer(storePath, {"Temperature", "Conductance"});
+    for (size_t image = 0; image < identifiers.size(); ++image) {
+      writer.add(identifiers[image],
+                 {&temperatures[image], &conductances[image]});
+    }
+    Image wrongSize(width + 1, height);
+    checkThrows<std::runtime_error>(
+        [&] { writer.add("11", {&wrongSize, &wrongSize}); },
+        "Adding an image of another size to a store");
+    checkThrows<std::runtime_error>(
+        [&] { writer.add("11", {&temperatures[0]}); },
+        "Adding too few quantities to a store");
+    writer.close();
+  }
+
+  TimeSeriesStore store(storePath);
+  check(store.width() == width && store.height() == height &&
+            store.imageIdentifiers() == identifiers &&
+            store.quantities() ==
+                std::vector<std::string>({"Temperature", "Conductance"}),
+        "A store reads back its size, quantities and images");
+
+  // Every pixel's series is the pixel's value in each image, in order.
+  bool seriesMatch = true;
+  for (int row = 0; row < height; ++row) {
+    for (int column = 0; column < width; ++column) {
+      std::vector<Scalar> series = store.series("Conductance", row, column);
+      for (size_t image = 0; image < identifiers.size(); ++image) {
+        seriesMatch = seriesMatch && series.size() == identifiers.size() &&
+                      series[image] == conductances[image](row, column);
+      }
+    }
+  }
+  check(seriesMatch, "Every pixel's series is transposed correctly");
+
+  Image region = store.region("Temperature", 1, 2, 2, 2);
+  bool regionMatches = region.width() == int(identifiers.size()) &&
+                       region.height() == 4;
+  for (int pixel = 0; regionMatches && pixel < 4; ++pixel) {
+    for (size_t image = 0; image < identifiers.size(); ++image) {
+      Scalar expected = temperatures[image](1 + pixel / 2, 2 + pixel % 2);
+      regionMatches = regionMatches && region(pixel, image) == expected;
+    }
+  }
+  check(regionMatches, "A region holds its pixels' series in row-major order");
+  checkThrows<std::out_of_range>(
+      [&] { store.region("Temperature", 2, 3, 2, 1); },
+      "A region reaching past the images");
+  checkThrows<std::runtime_error>([&] { store.series("Wp", 0, 0); },
+                                  "Reading a quantity the store does not have");
+
+  check(filesIn(directory.path).size() == 1,
+        "A closed store leaves no scratch file behind");
+  truncateFile(storePath, boost::filesystem::file_size(storePath) - 8);
+  checkThrows<std::runtime_error>([&] { TimeSeriesStore{storePath}; },
+                                  "Opening a truncated store");
+  truncateFile(storePath, 40);
+  checkThrows<std::runtime_error>([&] { TimeSeriesStore{storePath}; },
+                                  "Opening a store with truncated names");
+  writeText(storePath, "T2CA");
+  checkThrows<std::runtime_error>([&] { TimeSeriesStore{storePath}; },
+                                  "Opening a file that is not a store");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* INPUT MANIFESTS */
+
+// Runs a job with --incremental, with its progress messages silenced, and
+// returns whether it succeeded.
+bool runIncrementalJob(const Path &base, int rValue) {
+  ConverterOptions options;
+  options.quiet = true;
+  options.recomputeChangedOnly = true;
+  options.workerCount = 1;
+  ConductanceJob job;
+  job.date = SyntheticDataOptions().date;
+  job.rValue = rValue;
+  job.cropWindow = {Coordinate(1, 1), Coordinate(8, 6)};
+
+  std::ostringstream progress;
+  std::streambuf *console = std::cout.rdbuf(progress.rdbuf());
+  int failedJobs = BatchRunner(base.string() + "/", options).run({job});
+  std::cout.rdbuf(console);
+  if (failedJobs > 0) {
+    std::cout << progress.str();
+  }
+  return failedJobs == 0;
+}
+
+void testInputManifest() {
+  TemporaryDirectory directory;
+  Path manifestPath = directory.path / "InputManifest.csv";
+  check(loadInputManifest(manifestPath).empty(),
+        "A manifest that does not exist is empty");
+
+  InputManifest manifest;
+  manifest["1"] = {"a1", "b1", "c1", "d1"};
+  manifest["12"] = {"a2", "b2", "c2", "d2"};
+  saveInputManifest(manifestPath, manifest);
+  InputManifest loaded = loadInputManifest(manifestPath);
+  check(loaded.size() == 2 && loaded["1"] == manifest["1"] &&
+            loaded["12"] == manifest["12"] && loaded["1"] != loaded["12"],
+        "A manifest reads back what was saved");
+  writeText(manifestPath, "Image,Frames\n1,a\n");
+  checkThrows<std::runtime_error>([&] { loadInputManifest(manifestPath); },
+                                  "Loading a manifest with a bad header");
+  writeText(manifestPath,
+            "Image identifier,Frames,K matrix,Program data,Settings\n1,a,b\n");
+  checkThrows<std::runtime_error>([&] { loadInputManifest(manifestPath); },
+                                  "Loading a manifest with a short row");
+
+  // A file's fingerprint changes with its contents' size.
+  Path framePath = directory.path / "frame.csv";
+  writeText(framePath, "1,2\n");
+  Fingerprint before;
+  before.addFileStamp(framePath);
+  writeText(framePath, "1,2,3\n");
+  Fingerprint after;
+  after.addFileStamp(framePath);
+  check(before.hex() != after.hex() && before.hex().size() == 16,
+        "A file's fingerprint changes when it is rewritten");
+  checkThrows<std::runtime_error>(
+      [&] { Fingerprint().addFileStamp(directory.path / "missing.csv"); },
+      "Fingerprinting a file that does not exist");
+
+  // The up-to-date decision, on a whole run. Maps that are not recomputed
+  // keep the marker written over them.
+  SyntheticDataOptions dataOptions;
+  dataOptions.width = 8;
+  dataOptions.height = 6;
+  dataOptions.imageCount = 3;
+  dataOptions.framesPerImage = 2;
+  SyntheticData data = writeSyntheticData(directory.path, dataOptions);
+  Path dateDirectory = directory.path / "Data" / dataOptions.date;
+  auto mapPath = [&](const std::string &identifier) {
+    return dateDirectory / "ConductanceImages" /
+           (dataOptions.date + "_Conductance_" + identifier + ".csv");
+  };
+  const std::string marker = "not recomputed\n";
+  auto markMaps = [&]() {
+    for (auto &&identifier : data.imageIdentifiers) {
+      writeText(mapPath(identifier), marker);
+    }
+  };
+  auto recomputed = [&](const std::string &identifier) {
+    return readText(mapPath(identifier)) != marker;
+  };
+
+  check(runIncrementalJob(directory.path, 300), "The first run succeeds");
+  check(loadInputManifest(dateDirectory / "InputManifest.csv").size() == 3,
+        "A run saves the fingerprints of every image");
+  markMaps();
+  check(runIncrementalJob(directory.path, 300) && !recomputed("1") &&
+            !recomputed("2") && !recomputed("3"),
+        "A run with nothing changed recomputes nothing");
+
+  writeText(data.frames[1][0], readText(data.frames[1][0]) + "\n");
+  check(runIncrementalJob(directory.path, 300) && !recomputed("1") &&
+            recomputed("2") && !recomputed("3"),
+        "A run recomputes only the image whose frame changed");
+
+  markMaps();
+  boost::filesystem::remove(mapPath("3"));
+  check(runIncrementalJob(directory.path, 300) && !recomputed("1") &&
+            !recomputed("2") && boost::filesystem::exists(mapPath("3")),
+        "A run recomputes an image whose map was removed");
+
+  markMaps();
+  check(runIncrementalJob(directory.path, 301) && recomputed("1") &&
+            recomputed("2") && recomputed("3"),
+        "A run with another R value recomputes every image");
+}
+
+const std::map<std::string, std::function<void()>> tests = {
+    {"FrameReader", testFrameReader},
+    {"FrameCache", testFrameCache},
+    {"DirectoryIndex", testDirectoryIndex},
+    {"NpyFile", testNpyFile},
+    {"MapArchive", testMapArchive},
+    {"TimeSeriesStore", testTimeSeriesStore},
+    {"InputManifest", testInputManifest},
+    {"IntegralImage", testIntegralImage},
+    {"BoxFilter", testBoxFilter},
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> names(argv + 1, argv + argc);
+  if (names.empty()) {
+    for (auto &&test : tests) {
+      names.push_back(test.first);
+    }
+  }
+
+  for (auto &&name : names) {
+    auto test = tests.find(name);
+    if (test == tests.end()) {
+      std::cout << "Unknown test: " << name << std::endl;
+      return 1;
+    }
+    int failuresBefore = failures;
+    try {
+      test->second();
+    } catch (const std::exception &error) {
+      check(false, name + " threw: " + error.what());
+    }
+    std::cout << name << ": "
+              << (failures == failuresBefore ? "passed" : "FAILED")
+              << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include "ThreadPool.hpp"
+
+namespace {
+
+// The pool and queue index of the worker running on this thread, if any.
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned workerCount)
+    : queuedTasks(0), stopping(false) {
+  if (workerCount == 0) {
+    workerCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned i = 0; i <= workerCount; ++i) {
+    queues.emplace_back(new TaskQueue());
+  }
+  for (unsigned i = 0; i < workerCount; ++i) {
+    workers.emplace_back(&ThreadPool::runWorker, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  taskAvailable.notify_all();
+  for (auto &&worker : workers) {
+    worker.join();
+  }
+}
+
+int ThreadPool::currentWorkerIndex() const {
+  return currentPool == this ? currentWorker : -1;
+}
+
+void ThreadPool::push(std::function<void()> task) {
+  int worker = currentWorkerIndex();
+  TaskQueue &queue = *queues[worker >= 0 ? worker : workers.size()];
+  {
+    std::lock_guard<std::mutex> lock(queue.queueMutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    // Taking the lock orders the count update with a worker that is about
+    // to sleep, so the notification cannot be missed.
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    ++queuedTasks;
+  }
+  taskAvailable.notify_one();
+}
+
+bool ThreadPool::popTask(int ownQueue, std::function<void()> &task) {
+  // Newest task from our own queue first, as it is most likely still cached.
+  if (ownQueue >= 0) {
+    TaskQueue &queue = *queues[ownQueue];
+    std::lock_guard<std::mutex> lock(queue.queueMutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      --queuedTasks;
+      return true;
+    }
+  }
+
+  // Otherwise steal the oldest task of another queue, starting with our
+  // neighbour so that thieves spread out.
+  const int numberQueues = queues.size();
+  for (int offset = 1; offset <= numberQueues; ++offset) {
+    int victim = (std::max(ownQueue, 0) + offset) % numberQueues;
+    if (victim == ownQueue) {
+      continue;
+    }
+    TaskQueue &queue = *queues[victim];
+    std::lock_guard<std::mutex> lock(queue.queueMutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      --queuedTasks;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::runPendingTask() {
+  std::function<void()> task;
+  if (!popTask(currentWorkerIndex(), task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+void ThreadPool::runWorker(int index) {
+  currentPool = this;
+  currentWorker = index;
+  while (true) {
+    std::function<void()> task;
+    if (popTask(index, task)) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    taskAvailable.wait(lock,
+                       [this]() { return stopping || queuedTasks > 0; });
+    if (stopping && queuedTasks == 0) {
+      return;
+    }
+  }
+}
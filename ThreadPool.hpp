@@ -0,0 +1,118 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A work-stealing pool of worker threads.
+//
+// Every worker has its own task deque. Tasks submitted from inside a task go
+// to the submitting worker's deque, which the worker drains newest first;
+// idle workers steal the oldest tasks from the other deques, and from the
+// shared deque that receives tasks submitted from outside the pool. Threads
+// that wait on a result through wait() run queued tasks in the meantime, so
+// tasks can split their work into subtasks and wait for them without
+// starving the pool.
+class ThreadPool {
+public:
+  // A worker count of 0 starts one worker per hardware thread.
+  explicit ThreadPool(unsigned workerCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return workers.size(); }
+
+  // Queues the task and returns a future for its result. Exceptions thrown
+  // by the task are rethrown from the future.
+  template <typename Task>
+  std::future<typename std::result_of<Task()>::type> submit(Task task) {
+    using Result = typename std::result_of<Task()>::type;
+    auto packagedTask =
+        std::make_shared<std::packaged_task<Result()>>(std::move(task));
+    std::future<Result> result = packagedTask->get_future();
+    push([packagedTask]() { (*packagedTask)(); });
+    return result;
+  }
+
+  // Returns the result of the future, running queued tasks on the calling
+  // thread until it is ready.
+  template <typename Result> Result wait(std::future<Result> &result) {
+    while (result.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      if (!runPendingTask()) {
+        result.wait_for(std::chrono::microseconds(100));
+      }
+    }
+    return result.get();
+  }
+
+  // Calls body(begin, end) for consecutive ranges of at most grainSize
+  // indices covering [0, count), spread over the pool, and returns once
+  // every range is done.
+  template <typename Body>
+  void parallelFor(int count, int grainSize, const Body &body) {
+    grainSize = std::max(1, grainSize);
+    std::vector<std::future<void>> ranges;
+    for (int begin = grainSize; begin < count; begin += grainSize) {
+      int end = std::min(count, begin + grainSize);
+      ranges.push_back(submit([&body, begin, end]() { body(begin, end); }));
+    }
+    // The calling thread takes the first range itself.
+    std::exception_ptr firstError;
+    try {
+      body(0, std::min(count, grainSize));
+    } catch (...) {
+      firstError = std::current_exception();
+    }
+    for (auto &&range : ranges) {
+      try {
+        wait(range);
+      } catch (...) {
+        if (!firstError) {
+          firstError = std::current_exception();
+        }
+      }
+    }
+    if (firstError) {
+      std::rethrow_exception(firstError);
+    }
+  }
+
+  // Runs one queued task on the calling thread. Returns false if there was
+  // nothing to run.
+  bool runPendingTask();
+
+private:
+  struct TaskQueue {
+    std::mutex queueMutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::thread> workers;
+  // One queue per worker, followed by the queue for outside submissions.
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+
+  std::mutex sleepMutex;
+  std::condition_variable taskAvailable;
+  std::atomic<int> queuedTasks;
+  bool stopping;
+
+  void push(std::function<void()> task);
+  bool popTask(int ownQueue, std::function<void()> &task);
+  int currentWorkerIndex() const;
+  void runWorker(int index);
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "TimeSeriesStore.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char storeMagic[4] = {'T', '2', 'C', 'S'};
+const uint32_t storeVersion = 1;
+const uint64_t dataAlignment = 64;
+
+// The number of bytes of series close() gathers before writing them out.
+const size_t transposeBufferSize = 16 << 20;
+
+struct StoreHeader {
+  char magic[4];
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  uint32_t imageCount;
+  uint32_t quantityCount;
+  uint32_t elementSize;
+  uint32_t reserved;
+  uint64_t dataOffset;
+};
+
+uint64_t alignUp(uint64_t size) {
+  return (size + dataAlignment - 1) / dataAlignment * dataAlignment;
+}
+
+// Converts a row of pixels to elements of elementSize bytes.
+void writePixels(std::ofstream &outputFile, const Scalar *values, int count,
+                 uint32_t elementSize, std::vector<float> &floatRow,
+                 std::vector<double> &doubleRow) {
+  if (elementSize == sizeof(Scalar)) {
+    outputFile.write(reinterpret_cast<const char *>(values),
+                     count * sizeof(Scalar));
+  } else if (elementSize == sizeof(float)) {
+    floatRow.assign(values, values + count);
+    outputFile.write(reinterpret_cast<const char *>(floatRow.data()),
+                     count * sizeof(float));
+  } else {
+    doubleRow.assign(values, values + count);
+    outputFile.write(reinterpret_cast<const char *>(doubleRow.data()),
+                     count * sizeof(double));
+  }
+}
+
+void writeName(std::ofstream &outputFile, const std::string &name) {
+  uint32_t length = name.size();
+  outputFile.write(reinterpret_cast<const char *>(&length), sizeof(length));
+  outputFile.write(name.data(), name.size());
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+/* WRITER */
+
+TimeSeriesWriter::TimeSeriesWriter(const boost::filesystem::path &path,
+                                   const std::vector<std::string> &quantities,
+                                   int elementSize)
+    : storePath(path), scratchPath(path.string() + ".scratch"),
+      quantities(quantities), elementSize(elementSize), width(0), height(0) {
+  if (elementSize != 4 && elementSize != 8) {
+    throw std::runtime_error("Time series must be float32 or float64.");
+  }
+  if (quantities.empty()) {
+    throw std::runtime_error("A time series store needs a quantity.");
+  }
+  scratchFile.open(scratchPath.string(), std::ios::binary);
+  if (!scratchFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + scratchPath.string());
+  }
+}
+
+TimeSeriesWriter::~TimeSeriesWriter() {
+  boost::system::error_code ignored;
+  if (scratchFile.is_open()) {
+    scratchFile.close();
+  }
+  boost::filesystem::remove(scratchPath, ignored);
+  boost::filesystem::remove(storePath.string() + ".tmp", ignored);
+}
+
+void TimeSeriesWriter::add(const std::string &imageIdentifier,
+                           const std::vector<const Image *> &images) {
+  if (images.size() != quantities.size()) {
+    throw std::runtime_error("Expected an image of each of the " +
+                             std::to_string(quantities.size()) +
+                             " quantities of the time series.");
+  }
+  if (imageIdentifiers.empty()) {
+    width = images.front()->width();
+    height = images.front()->height();
+  }
+  for (auto &&image : images) {
+    if (image->width() != width || image->height() != height) {
+      throw std::runtime_error("Image " + imageIdentifier +
+                               " does not have the dimensions of the other "
+                               "images of the time series.");
+    }
+  }
+
+  std::vector<float> floatRow;
+  std::vector<double> doubleRow;
+  for (auto &&image : images) {
+    for (int row = 0; row < height; ++row) {
+      writePixels(scratchFile, image->rowData(row), width, elementSize,
+                  floatRow, doubleRow);
+    }
+  }
+  if (scratchFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + scratchPath.string());
+  }
+  imageIdentifiers.push_back(imageIdentifier);
+}
+
+void TimeSeriesWriter::close() {
+  scratchFile.close();
+  if (scratchFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + scratchPath.string());
+  }
+  boost::filesystem::path temporaryPath(storePath.string() + ".tmp");
+  writeStore(temporaryPath);
+  boost::filesystem::rename(temporaryPath, storePath);
+  boost::filesystem::remove(scratchPath);
+}
+
+void TimeSeriesWriter::writeStore(const boost::filesystem::path &path) {
+  std::ofstream outputFile(path.string(), std::ios::binary);
+  if (!outputFile.is_open()) {
+    throw std::runtime_error("ERROR OPENING FILE: " + path.string());
+  }
+
+  StoreHeader header = {};
+  std::memcpy(header.magic, storeMagic, sizeof(storeMagic));
+  header.version = storeVersion;
+  header.width = width;
+  header.height = height;
+  header.imageCount = imageIdentifiers.size();
+  header.quantityCount = quantities.size();
+  header.elementSize = elementSize;
+  uint64_t namesSize = 0;
+  for (auto &&name : quantities) {
+    namesSize += sizeof(uint32_t) + name.size();
+  }
+  for (auto &&name : imageIdentifiers) {
+    namesSize += sizeof(uint32_t) + name.size();
+  }
+  header.dataOffset = alignUp(sizeof(header) + namesSize);
+
+  outputFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (auto &&name : quantities) {
+    writeName(outputFile, name);
+  }
+  for (auto &&name : imageIdentifiers) {
+    writeName(outputFile, name);
+  }
+  const char padding[dataAlignment] = {};
+  outputFile.write(padding, header.dataOffset - sizeof(header) - namesSize);
+
+  const size_t imageCount = imageIdentifiers.size();
+  const size_t pixelCount = size_t(width) * height;
+  if (imageCount > 0 && pixelCount > 0) {
+    // Scratch images are stored image by image, each image holding every
+    // quantity in turn.
+    MappedFile scratch(scratchPath);
+    const size_t imageSize = pixelCount * elementSize;
+    const size_t seriesSize = imageCount * elementSize;
+    const size_t bandPixels =
+        std::max<size_t>(1, transposeBufferSize / seriesSize);
+    std::vector<char> band(std::min(bandPixels, pixelCount) * seriesSize);
+
+    for (size_t quantity = 0; quantity < quantities.size(); ++quantity) {
+      for (size_t firstPixel = 0; firstPixel < pixelCount;
+           firstPixel += bandPixels) {
+        size_t lastPixel = std::min(pixelCount, firstPixel + bandPixels);
+        for (size_t image = 0; image < imageCount; ++image) {
+          const char *source =
+              scratch.begin() +
+              (image * quantities.size() + quantity) * imageSize +
+              firstPixel * elementSize;
+          char *destination = band.data() + image * elementSize;
+          for (size_t pixel = firstPixel; pixel < lastPixel; ++pixel) {
+            std::memcpy(destination, source, elementSize);
+            source += elementSize;
+            destination += seriesSize;
+          }
+        }
+        outputFile.write(band.data(), (lastPixel - firstPixel) * seriesSize);
+      }
+      uint64_t quantitySize = pixelCount * seriesSize;
+      outputFile.write(padding, alignUp(quantitySize) - quantitySize);
+    }
+  }
+  outputFile.close();
+  if (outputFile.fail()) {
+    throw std::runtime_error("ERROR WRITING FILE: " + path.string());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* READER */
+
+TimeSeriesStore::TimeSeriesStore(const boost::filesystem::path &path)
+    : storePath(path), file(new MappedFile(path)) {
+  auto badStore = [&path](const std::string &problem) {
+    return std::runtime_error(path.string() + ": " + problem);
+  };
+
+  StoreHeader header;
+  if (file->size() < sizeof(header)) {
+    throw badStore("Not a time series store.");
+  }
+  std::memcpy(&header, file->begin(), sizeof(header));
+  if (std::memcmp(header.magic, storeMagic, sizeof(storeMagic)) != 0 ||
+      header.version != storeVersion) {
+    throw badStore("Not a time series store.");
+  }
+  if ((header.elementSize != 4 && header.elementSize != 8) ||
+      header.width < 0 || header.height < 0) {
+    throw badStore("The store header is corrupt.");
+  }
+  imageWidth = header.width;
+  imageHeight = header.height;
+  elementSize = header.elementSize;
+  dataOffset = header.dataOffset;
+
+  uint64_t position = sizeof(header);
+  auto readName = [&]() {
+    uint32_t length;
+    if (position + sizeof(length) > file->size()) {
+      throw badStore("The store names are truncated.");
+    }
+    std::memcpy(&length, file->begin() + position, sizeof(length));
+    position += sizeof(length);
+    if (position + length > file->size()) {
+      throw badStore("The store names are truncated.");
+    }
+    std::string name(file->begin() + position, length);
+    position += length;
+    return name;
+  };
+  for (uint32_t i = 0; i < header.quantityCount; ++i) {
+    names.push_back(readName());
+  }
+  for (uint32_t i = 0; i < header.imageCount; ++i) {
+    identifiers.push_back(readName());
+  }
+
+  uint64_t quantitySize = alignUp(uint64_t(imageWidth) * imageHeight *
+                                  identifiers.size() * elementSize);
+  if (position > dataOffset ||
+      dataOffset + names.size() * quantitySize > file->size()) {
+    throw badStore("The store is truncated.");
+  }
+}
+
+size_t TimeSeriesStore::quantityIndex(const std::string &quantity) const {
+  auto found = std::find(names.begin(), names.end(), quantity);
+  if (found == names.end()) {
+    throw std::runtime_error(storePath.string() + " has no quantity named " +
+                             quantity + ".");
+  }
+  return found - names.begin();
+}
+
+std::vector<Scalar> TimeSeriesStore::series(const std::string &quantity,
+                                            int row, int column) const {
+  Image values = region(quantity, row, column, 1, 1);
+  return std::vector<Scalar>(values.rowData(0),
+                             values.rowData(0) + values.width());
+}
+
+Image TimeSeriesStore::region(const std::string &quantity, int firstRow,
+                              int firstColumn, int height, int width) const {
+  size_t index = quantityIndex(quantity);
+  if (firstRow < 0 || firstColumn < 0 || height < 0 || width < 0 ||
+      firstRow + height > imageHeight || firstColumn + width > imageWidth) {
+    throw std::out_of_range("The region is outside of the images.");
+  }
+  Image regionSeries(identifiers.size(), height * width);
+  for (int row = 0; row < height; ++row) {
+    for (int column = 0; column < width; ++column) {
+      readSeries(index, firstRow + row, firstColumn + column,
+                 regionSeries.rowData(row * width + column));
+    }
+  }
+  return regionSeries;
+}
+
+void TimeSeriesStore::readSeries(size_t quantity, int row, int column,
+                                 Scalar *destination) const {
+  const size_t imageCount = identifiers.size();
+  const uint64_t quantitySize =
+      alignUp(uint64_t(imageWidth) * imageHeight * imageCount * elementSize);
+  const char *source =
+      file->begin() + dataOffset + quantity * quantitySize +
+      (uint64_t(row) * imageWidth + column) * imageCount * elementSize;
+  if (elementSize == sizeof(Scalar)) {
+    std::memcpy(destination, source, imageCount * sizeof(Scalar));
+  } else if (elementSize == sizeof(float)) {
+    for (size_t image = 0; image < imageCount; ++image) {
+      float value;
+      std::memcpy(&value, source + image * sizeof(float), sizeof(float));
+      destination[image] = static_cast<Scalar>(value);
+    }
+  } else {
+    for (size_t image = 0; image < imageCount; ++image) {
+      double value;
+      std::memcpy(&value, source + image * sizeof(double), sizeof(double));
+      destination[image] = static_cast<Scalar>(value);
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef TIME_SERIES_STORE
+#define TIME_SERIES_STORE
+
+#include "Image.hpp"
+#include "MappedFile.hpp"
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The images of a date stored pixel-major: the values a pixel takes in every
+// image of the date are contiguous, so the series of a pixel is a single
+// read, however many images the date has.
+//
+// A store holds one or more quantities, e.g. the average temperature and the
+// conductance, each with a value for every pixel of every image. Layout, in
+// the byte order of the machine that wrote it:
+//
+//   header   "T2CS", uint32 version, int32 width, int32 height,
+//            uint32 image count, uint32 quantity count, uint32 element size
+//            (8 or 4), uint32 reserved, uint64 data offset
+//   names    each quantity name, then each image identifier, as a uint32
+//            length followed by the text
+//   data     for each quantity, starting on a 64 byte boundary: for each
+//            pixel in row-major order, its value in each image as float64 or
+//            float32
+//
+// Images arrive one at a time while the maps are created, so the writer
+// first appends them to a scratch file image by image, and close()
+// transposes the scratch file into the store a band of pixels at a time.
+
+// Writes a store. Not thread-safe.
+class TimeSeriesWriter {
+public:
+  TimeSeriesWriter(const boost::filesystem::path &,
+                   const std::vector<std::string> &quantities,
+                   int elementSize = 8);
+  // Abandons the store if close() was not called.
+  ~TimeSeriesWriter();
+
+  TimeSeriesWriter(const TimeSeriesWriter &) = delete;
+  TimeSeriesWriter &operator=(const TimeSeriesWriter &) = delete;
+
+  // Adds one image of each quantity, in the order the quantities were given.
+  // Every image must have the dimensions of the first one.
+  void add(const std::string &imageIdentifier,
+           const std::vector<const Image *> &images);
+  void close();
+
+private:
+  boost::filesystem::path storePath;
+  boost::filesystem::path scratchPath;
+  std::ofstream scratchFile;
+  std::vector<std::string> quantities;
+  std::vector<std::string> imageIdentifiers;
+  uint32_t elementSize;
+  int width;
+  int height;
+
+  void writeStore(const boost::filesystem::path &);
+};
+
+// Serves the series of pixels and regions straight from a memory-mapped
+// store.
+class TimeSeriesStore {
+public:
+  explicit TimeSeriesStore(const boost::filesystem::path &);
+
+  int width() const { return imageWidth; }
+  int height() const { return imageHeight; }
+  const std::vector<std::string> &quantities() const { return names; }
+  const std::vector<std::string> &imageIdentifiers() const {
+    return identifiers;
+  }
+
+  // The value of the pixel in each image, in the order of
+  // imageIdentifiers().
+  std::vector<Scalar> series(const std::string &quantity, int row,
+                             int column) const;
+  // The series of every pixel of the region whose top left pixel is
+  // (firstRow, firstColumn): row i of the result is the series of the i-th
+  // pixel of the region in row-major order. Throws std::out_of_range unless
+  // the region lies inside the images.
+  Image region(const std::string &quantity, int firstRow, int firstColumn,
+               int height, int width) const;
+
+private:
+  boost::filesystem::path storePath;
+  std::unique_ptr<MappedFile> file;
+  int imageWidth;
+  int imageHeight;
+  uint32_t elementSize;
+  uint64_t dataOffset;
+  std::vector<std::string> names;
+  std::vector<std::string> identifiers;
+
+  size_t quantityIndex(const std::string &) const;
+  void readSeries(size_t quantity, int row, int column,
+                  Scalar *destination) const;
+};
+
+#endif
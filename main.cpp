@@ -1,16 +1,355 @@
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "BatchRunner.hpp"
 #include "ImageConverter.hpp"
+#include "MapArchive.hpp"
+#include "TimeSeriesStore.hpp"
 
-int main(void) {
-  std::string baseDirectory = "/Users/katiesweet/Desktop/Patchy/";
+void printUsage() {
+  std::cout << "Usage: TemperatureToConductance [options]" << std::endl;
+  std::cout << "       TemperatureToConductance query ARCHIVE [MAP [ROW "
+               "COLUMN [HEIGHT WIDTH]]]"
+            << std::endl;
+  std::cout << "       TemperatureToConductance series STORE [QUANTITY ROW "
+               "COLUMN [HEIGHT WIDTH]]"
+            << std::endl;
+  std::cout << "Without --job, --jobs, --kmatrix-jobs or --watch, the "
+               "program asks what to run."
+            << std::endl;
+  std::cout << "\t--base DIR\tDirectory holding the Data and KMatrix "
+               "directories."
+            << std::endl;
+  std::cout << "\t--job DATE,R[,TOPLEFT,BOTTOMRIGHT[,PIXELS]]\tCreate the "
+               "conductance maps of DATE without asking anything. May be "
+               "repeated."
+            << std::endl;
+  std::cout << "\t--jobs FILE\tRun every job listed in FILE, one per line "
+               "in the --job format."
+            << std::endl;
+  std::cout << "\t--kmatrix-jobs FILE\tCreate the K matrix of every "
+               "calibration directory listed in FILE, one per line as "
+               "DIRECTORY,R,UPPERBEFORE,UPPERAFTER,LOWERBEFORE,LOWERAFTER"
+               "[,TOPLEFT,BOTTOMRIGHT]."
+            << std::endl;
+  std::cout << "\t--watch DATE,R[,TOPLEFT,BOTTOMRIGHT[,PIXELS]]\tKeep the "
+               "conductance maps of DATE up to date as frames and program "
+               "data rows arrive, until interrupted."
+            << std::endl;
+  std::cout << "\t--settle SECONDS\tWith --watch, wait until nothing has "
+               "changed for SECONDS before updating the maps (default: 2)."
+            << std::endl;
+  std::cout << "\t--workers N\tParse frames with N threads (default: one "
+               "per hardware thread)."
+            << std::endl;
+  std::cout << "\t--no-frame-cache\tAlways parse frames from their CSV files."
+            << std::endl;
+  std::cout << "\t--kernel NAME\tConductance kernel: auto, scalar, avx2 or "
+               "avx512 (default: auto)."
+            << std::endl;
+  std::cout << "\t--fast-wp\tInterpolate wp from a table (relative error "
+               "below 1.2e-7) instead of evaluating exp for every pixel."
+            << std::endl;
+  std::cout << "\t--precision N\tSave images with N significant digits "
+               "(default: 0, the fewest digits that keep every value exact)."
+            << std::endl;
+  std::cout << "\t--format NAME\tSave images as csv, npy (float64) or npy32 "
+               "(float32) files (default: csv)."
+            << std::endl;
+  std::cout << "\t--archive\tPack the maps of each date into one "
+               "DATE_Maps.t2ca archive."
+            << std::endl;
+  std::cout << "\t--foreground-writes\tSave images on the thread that "
+               "calculated them."
+            << std::endl;
+  std::cout << "\t--validate-precision\tAlso calculate every conductance "
+               "map in float and double, and save their differences to "
+               "PrecisionValidation.csv."
+            << std::endl;
+  std::cout << "\t--leaflet N|WxH\tAverage leaflet values over an N x N or "
+               "W x H window, clipped at the image edges (default: 3)."
+            << std::endl;
+  std::cout << "\t--pixels FILE\tSave the pixel and leaflet values of every "
+               "pixel listed in FILE to PixelTable.csv, one row per image and "
+               "pixel."
+            << std::endl;
+  std::cout << "\t--time-series\tSave the temperature and conductance of "
+               "every pixel across the images of each date to "
+               "DATE_TimeSeries.t2cs."
+            << std::endl;
+  std::cout << "\t--leaflet-maps\tAlso save the leaflet conductance of "
+               "every pixel as a LeafletConductance map."
+            << std::endl;
+  std::cout << "\t--incremental\tOnly recompute the images whose frames, K "
+               "matrix, program data row, R value, crop window or output "
+               "settings changed since the InputManifest.csv of the last run."
+            << std::endl;
+  std::cout << "\t--quiet\tDo not print a line for every file loaded or "
+               "saved."
+            << std::endl;
+  std::cout << "\t--report FILE\tSave the time, bytes read and written and "
+               "pixels of each stage, and the peak memory of the run, to FILE "
+               "as JSON."
+            << std::endl;
+}
 
-  ImageConverter temperatureToConductance(baseDirectory);
-  // temperatureToConductance.chooseProgramTypeAndExecute();
+// The whole of the text as a number, so that "5abc" is not read as 5.
+int parseWholeInteger(const std::string &option, const std::string &text) {
+  size_t length = 0;
+  int value = 0;
+  try {
+    value = std::stoi(text, &length);
+  } catch (const std::exception &) {
+  }
+  if (length == 0 || length != text.size()) {
+    throw std::runtime_error(option + " needs a whole number, not \"" + text +
+                             "\".");
+  }
+  return value;
+}
+
+double parseWholeNumber(const std::string &option, const std::string &text) {
+  size_t length = 0;
+  double value = 0.0;
+  try {
+    value = std::stod(text, &length);
+  } catch (const std::exception &) {
+  }
+  if (length == 0 || length != text.size()) {
+    throw std::runtime_error(option + " needs a number, not \"" + text +
+                             "\".");
+  }
+  return value;
+}
+
+// Lists the maps of an archive, or prints a whole map, a single pixel or a
+// tile of a map.
+int queryArchive(const std::vector<std::string> &arguments) {
+  if (arguments.size() != 2 && arguments.size() != 3 &&
+      arguments.size() != 5 && arguments.size() != 7) {
+    printUsage();
+    return 1;
+  }
+  MapArchive archive(arguments[1]);
+  if (arguments.size() == 2) {
+    for (auto &&entry : archive.entries()) {
+      std::cout << entry.name << "," << entry.width << "," << entry.height
+                << ",float" << entry.elementSize * 8 << "\n";
+    }
+    return 0;
+  }
+
+  const std::string &map = arguments[2];
+  Image values;
+  if (arguments.size() == 3) {
+    values = archive.image(map);
+  } else {
+    int height = arguments.size() == 7 ? std::stoi(arguments[5]) : 1;
+    int width = arguments.size() == 7 ? std::stoi(arguments[6]) : 1;
+    values = archive.tile(map, std::stoi(arguments[3]),
+                          std::stoi(arguments[4]), height, width);
+  }
+  ImageWriter formatter;
+  std::string text;
+  for (int row = 0; row < values.height(); ++row) {
+    for (int column = 0; column < values.width(); ++column) {
+      if (column > 0) {
+        text.push_back(',');
+      }
+      formatter.format(values(row, column), text);
+    }
+    text.push_back('\n');
+  }
+  std::cout << text;
   return 0;
 }
 
+// Lists the quantities and images of a time series store, or prints the
+// series of a pixel or of every pixel of a region, one pixel per line.
+int queryTimeSeries(const std::vector<std::string> &arguments) {
+  if (arguments.size() != 2 && arguments.size() != 5 &&
+      arguments.size() != 7) {
+    printUsage();
+    return 1;
+  }
+  TimeSeriesStore store(arguments[1]);
+  if (arguments.size() == 2) {
+    std::cout << "Quantities:";
+    for (auto &&quantity : store.quantities()) {
+      std::cout << " " << quantity;
+    }
+    std::cout << "\nImages:";
+    for (auto &&identifier : store.imageIdentifiers()) {
+      std::cout << " " << identifier;
+    }
+    std::cout << "\nSize: " << store.width() << "x" << store.height()
+              << std::endl;
+    return 0;
+  }
+
+  int firstRow = std::stoi(arguments[3]);
+  int firstColumn = std::stoi(arguments[4]);
+  int height = arguments.size() == 7 ? std::stoi(arguments[5]) : 1;
+  int width = arguments.size() == 7 ? std::stoi(arguments[6]) : 1;
+  Image series =
+      store.region(arguments[2], firstRow, firstColumn, height, width);
+  ImageWriter formatter;
+  std::string text = "Row,Column";
+  for (auto &&identifier : store.imageIdentifiers()) {
+    text += "," + identifier;
+  }
+  text.push_back('\n');
+  for (int pixel = 0; pixel < series.height(); ++pixel) {
+    text += std::to_string(firstRow + pixel / width) + "," +
+            std::to_string(firstColumn + pixel % width);
+    for (auto &&value : series.row(pixel)) {
+      text.push_back(',');
+      formatter.format(value, text);
+    }
+    text.push_back('\n');
+  }
+  std::cout << text;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::string baseDirectory = "/Users/katiesweet/Desktop/Patchy/";
+
+  ConverterOptions options;
+  std::vector<ConductanceJob> jobs;
+  std::vector<KMatrixJob> kMatrixJobs;
+  std::string reportPath;
+  ConductanceJob watchJob;
+  bool watching = false;
+  double settleSeconds = 2.0;
+  std::vector<std::string> arguments(argv + 1, argv + argc);
+  if (!arguments.empty() &&
+      (arguments[0] == "query" || arguments[0] == "series")) {
+    try {
+      return arguments[0] == "query" ? queryArchive(arguments)
+                                     : queryTimeSeries(arguments);
+    } catch (const std::exception &error) {
+      std::cout << "ERROR: " << error.what() << std::endl;
+      return 1;
+    }
+  }
+  // A bad argument or job file is reported rather than aborting, with the
+  // line of the job file it is on.
+  try {
+    for (size_t i = 0; i < arguments.size(); ++i) {
+      if (arguments[i] == "--base" && i + 1 < arguments.size()) {
+        baseDirectory = arguments[++i];
+        if (baseDirectory.back() != '/') {
+          baseDirectory.push_back('/');
+        }
+      } else if (arguments[i] == "--job" && i + 1 < arguments.size()) {
+        jobs.push_back(parseConductanceJob(arguments[++i]));
+      } else if (arguments[i] == "--jobs" && i + 1 < arguments.size()) {
+        auto jobsInFile = loadConductanceJobs(arguments[++i]);
+        jobs.insert(jobs.end(), jobsInFile.begin(), jobsInFile.end());
+      } else if (arguments[i] == "--kmatrix-jobs" && i + 1 < arguments.size()) {
+        auto jobsInFile = loadKMatrixJobs(arguments[++i]);
+        kMatrixJobs.insert(kMatrixJobs.end(), jobsInFile.begin(),
+                           jobsInFile.end());
+      } else if (arguments[i] == "--watch" && i + 1 < arguments.size()) {
+        watchJob = parseConductanceJob(arguments[++i]);
+        watching = true;
+      } else if (arguments[i] == "--settle" && i + 1 < arguments.size()) {
+        settleSeconds = parseWholeNumber("--settle", arguments[++i]);
+      } else if (arguments[i] == "--workers" && i + 1 < arguments.size()) {
+        int workerCount = parseWholeInteger("--workers", arguments[++i]);
+        if (workerCount < 0) {
+          throw std::runtime_error("--workers must not be negative.");
+        }
+        options.workerCount = workerCount;
+      } else if (arguments[i] == "--no-frame-cache") {
+        options.useFrameCache = false;
+      } else if (arguments[i] == "--kernel" && i + 1 < arguments.size()) {
+        options.kernelInstructionSet =
+            parseKernelInstructionSet(arguments[++i]);
+      } else if (arguments[i] == "--fast-wp") {
+        options.saturationEvaluation = SaturationEvaluation::Table;
+      } else if (arguments[i] == "--precision" && i + 1 < arguments.size()) {
+        options.outputPrecision =
+            parseWholeInteger("--precision", arguments[++i]);
+        if (options.outputPrecision < 0 || options.outputPrecision > 17) {
+          throw std::runtime_error("--precision must be between 0 and 17.");
+        }
+      } else if (arguments[i] == "--format" && i + 1 < arguments.size()) {
+        options.outputFormat = parseImageFormat(arguments[++i]);
+      } else if (arguments[i] == "--archive") {
+        options.packMapsIntoArchive = true;
+      } else if (arguments[i] == "--foreground-writes") {
+        options.backgroundWrites = false;
+      } else if (arguments[i] == "--validate-precision") {
+        options.validatePrecision = true;
+      } else if (arguments[i] == "--leaflet" && i + 1 < arguments.size()) {
+        options.leafletWindow = parseLeafletWindow(arguments[++i]);
+      } else if (arguments[i] == "--pixels" && i + 1 < arguments.size()) {
+        options.pixelQueries = ImageConverter::loadPixelQueries(arguments[++i]);
+      } else if (arguments[i] == "--time-series") {
+        options.buildTimeSeriesStore = true;
+      } else if (arguments[i] == "--leaflet-maps") {
+        options.createLeafletConductanceMaps = true;
+      } else if (arguments[i] == "--incremental") {
+        options.recomputeChangedOnly = true;
+      } else if (arguments[i] == "--quiet") {
+        options.quiet = true;
+      } else if (arguments[i] == "--report" && i + 1 < arguments.size()) {
+        reportPath = arguments[++i];
+        options.statistics = std::make_shared<RunStatistics>();
+      } else {
+        printUsage();
+        return 1;
+      }
+    }
+  } catch (const std::exception &error) {
+    std::cout << "ERROR: " << error.what() << std::endl;
+    return 1;
+  }
+
+  int failures = 0;
+  // Jobs report their own failures. Anything else that goes wrong, such as a
+  // bad directory in the interactive program, is reported here.
+  try {
+    if (!jobs.empty() || !kMatrixJobs.empty() || watching) {
+      BatchRunner batch(baseDirectory, options);
+      // K matrices come first, so that the jobs can use them, and watching
+      // comes last, as it only stops when interrupted.
+      if (!kMatrixJobs.empty()) {
+        failures += batch.runKMatrixJobs(kMatrixJobs);
+      }
+      if (!jobs.empty()) {
+        failures += batch.run(jobs);
+      }
+      if (watching) {
+        failures += batch.watch(watchJob, settleSeconds);
+      }
+    } else {
+      ImageConverter temperatureToConductance(baseDirectory, options);
+      // temperatureToConductance.chooseProgramTypeAndExecute();
+    }
+  } catch (const std::exception &error) {
+    std::cout << "ERROR: " << error.what() << std::endl;
+    ++failures;
+  }
+
+  // The report is also written when a job or the interactive program failed,
+  // to show how far it got.
+  if (options.statistics) {
+    try {
+      options.statistics->writeReport(reportPath);
+    } catch (const std::exception &error) {
+      std::cout << "ERROR: " << error.what() << std::endl;
+      return 1;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
+
 // Config File
 // Image # | Average Air Temperature | Wa lower
 